@@ -0,0 +1,26 @@
+#include "arena.h"
+#include "../benchmark/benchmark.h"
+
+void setup_arena(arena **a, size_t size) {
+	(void)size;
+	*a = mk_arena();
+}
+
+void teardown_arena(arena **a, size_t size) {
+	(void)size;
+	destroy_arena(*a);
+}
+
+// Allocate and write a small object; every so often a new page is committed
+char *alloc_object(arena **a, size_t size) {
+	char *p = arena_alloc(*a, 1, size);
+	p[0] = 1;
+	return p;
+}
+
+int main(void) {
+	arena *a;
+	benchmark_fixture(setup_arena, teardown_arena, alloc_object, &a, 16);
+	benchmark_fixture(setup_arena, teardown_arena, alloc_object, &a, 4096);
+	return bench_regressions != 0;
+}
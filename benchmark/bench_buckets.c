@@ -0,0 +1,51 @@
+// hashset_buckets.h declares the same names as hashset.h and arena.h, so it is built on its own
+// with its names changed, and the suite reaches it through the functions at the bottom.
+#define coefficients buckets_coefficients
+#define n_coefficients buckets_n_coefficients
+#define hash_integer buckets_hash_integer
+#define hash_pointer buckets_hash_pointer
+#define hash_string buckets_hash_string
+#define hashset_strcmp buckets_strcmp
+#define is_prime buckets_is_prime
+#define next_size buckets_next_size
+#define default_equality buckets_default_equality
+#define mk_hashset buckets_mk_hashset
+#define destroy_hashset buckets_destroy_hashset
+#define hashset_contains_key buckets_contains_key
+#define hashset_get buckets_hashset_get
+#define hash_insert buckets_hash_insert
+#define enlarge buckets_enlarge
+#define hashset_add buckets_hashset_add
+#define hashset_remove buckets_hashset_remove
+#define hashset_set buckets_hashset_set
+#define hashset_print buckets_hashset_print
+#define mk_arena buckets_mk_arena
+#define destroy_arena buckets_destroy_arena
+#define arena_alloc buckets_arena_alloc
+#define HASHSET_IMPLEMENTATION
+#include "../hashset/hashset_buckets.h"
+#include <stdint.h>
+
+void *mk_buckets(size_t capacity) {
+  hashset *h = malloc(sizeof(hashset));
+  mk_hashset(h, hash_integer, NULL, capacity);
+  return h;
+}
+
+void destroy_buckets(void *h) {
+  destroy_hashset(h);
+  free(h);
+}
+
+bool buckets_add(void *h, int64_t key) {
+  return hashset_add(h, (kvp_t) { .key = { .integer = key }, .value = { .integer = key } });
+}
+
+bool buckets_get(void *h, int64_t key) {
+  hashset_value value;
+  return hashset_get(h, (hashset_key) { .integer = key }, &value);
+}
+
+bool buckets_remove(void *h, int64_t key) {
+  return hashset_remove(h, (hashset_key) { .integer = key }, NULL);
+}
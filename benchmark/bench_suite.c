@@ -0,0 +1,296 @@
+// The structures of megalib on the same workloads: every structure holds the keys of a
+// bench_workload and runs its trace of lookups and writes. A write removes the key and inserts it
+// again, except in art, which cannot remove keys and inserts the key it already holds, and in
+// eytzinger, which cannot change and only runs lookups.
+//   ./bench_suite [max size] [structure ...]
+#include "../hashset/hashset.h"
+#define RBTREE_IMPLEMENTATION
+#include "../trees/rbtree.h"
+#define BPTREE_IMPLEMENTATION
+#include "../trees/bptree.h"
+#define EYTZINGER_IMPLEMENTATION
+#include "../trees/eytzinger.h"
+#define ART_IMPLEMENTATION
+#include "../trees/art.h"
+#define SKIPLIST_IMPLEMENTATION
+#include "../trees/skiplist.h"
+#define BITMAP_IMPLEMENTATION
+#include "../bitmap/bitmap.h"
+#define BENCHMARK_ALLOCATIONS
+#include "benchmark.h"
+
+// bench_buckets.c
+void *mk_buckets(size_t capacity);
+void destroy_buckets(void *h);
+bool buckets_add(void *h, int64_t key);
+bool buckets_get(void *h, int64_t key);
+bool buckets_remove(void *h, int64_t key);
+
+typedef struct {
+  bench_workload w;
+  hashset hashset;
+  void *buckets;
+  rbtree rbtree;
+  bptree bptree;
+  eytzinger_kary_t eytzinger;
+  art_tree art;
+  skiplist skiplist;
+  skiplist_handle *handle;
+  bitmap_t *bitmap;
+} suite;
+
+// Keys of the pointer keyed structures are the integers themselves
+static int compare_keys(const void *left, const void *right) {
+  intptr_t l = (intptr_t)left, r = (intptr_t)right;
+  return (l > r) - (l < r);
+}
+
+#define as_pointer(key) ((void*)(intptr_t)(key))
+
+// art orders keys by their bytes, so integers are stored big endian
+static void art_key(int64_t key, unsigned char out[8]) {
+  for (int i = 7; i >= 0; i--, key >>= 8)
+    out[i] = key & 0xff;
+}
+
+static void setup_workload(const bench_params *p, suite *s) {
+  mk_bench_workload(&s->w, p, 0);
+}
+
+void setup_hashset(const bench_params *p, suite *s) {
+  setup_workload(p, s);
+  mk_hashset(&s->hashset, hash_integer, NULL, p->load > 0 ? p->size / p->load : 0);
+  for (size_t i = 0; i < p->size; i++)
+    hashset_add(&s->hashset, (kvp_t) { .key = { .integer = s->w.keys[i] }, .value = { .integer = s->w.keys[i] } });
+}
+
+void teardown_hashset(const bench_params *p, suite *s) {
+  (void)p;
+  destroy_hashset(&s->hashset);
+  destroy_bench_workload(&s->w);
+}
+
+bool suite_hashset(const bench_params *p, suite *s) {
+  int write;
+  hashset_key key = { .integer = bench_workload_next(&s->w, &write) };
+  hashset_value value;
+  (void)p;
+  if (write) {
+    hashset_remove(&s->hashset, key, &value);
+    return hashset_add(&s->hashset, (kvp_t) { .key = key, .value = value });
+  }
+  return hashset_get(&s->hashset, key, &value);
+}
+
+void setup_buckets(const bench_params *p, suite *s) {
+  setup_workload(p, s);
+  s->buckets = mk_buckets(p->load > 0 ? p->size / p->load : 0);
+  for (size_t i = 0; i < p->size; i++)
+    buckets_add(s->buckets, s->w.keys[i]);
+}
+
+void teardown_buckets(const bench_params *p, suite *s) {
+  (void)p;
+  destroy_buckets(s->buckets);
+  destroy_bench_workload(&s->w);
+}
+
+bool suite_buckets(const bench_params *p, suite *s) {
+  int write;
+  int64_t key = bench_workload_next(&s->w, &write);
+  (void)p;
+  if (write) {
+    buckets_remove(s->buckets, key);
+    return buckets_add(s->buckets, key);
+  }
+  return buckets_get(s->buckets, key);
+}
+
+void setup_rbtree(const bench_params *p, suite *s) {
+  setup_workload(p, s);
+  mk_rbtree(&s->rbtree, compare_keys);
+  for (size_t i = 0; i < p->size; i++)
+    rbtree_insert(&s->rbtree, as_pointer(s->w.keys[i]), NULL);
+}
+
+void teardown_rbtree(const bench_params *p, suite *s) {
+  (void)p;
+  destroy_rbtree(&s->rbtree);
+  destroy_bench_workload(&s->w);
+}
+
+bool suite_rbtree(const bench_params *p, suite *s) {
+  int write;
+  int64_t key = bench_workload_next(&s->w, &write);
+  (void)p;
+  if (write) {
+    rbtree_delete(&s->rbtree, as_pointer(key), NULL);
+    return rbtree_insert(&s->rbtree, as_pointer(key), NULL);
+  }
+  return rbtree_find(&s->rbtree, as_pointer(key)) != NULL;
+}
+
+void setup_bptree(const bench_params *p, suite *s) {
+  setup_workload(p, s);
+  mk_bptree(&s->bptree, NULL);
+  for (size_t i = 0; i < p->size; i++)
+    bptree_insert(&s->bptree, (bptree_key) { .integer = s->w.keys[i] }, NULL);
+}
+
+void teardown_bptree(const bench_params *p, suite *s) {
+  (void)p;
+  destroy_bptree(&s->bptree);
+  destroy_bench_workload(&s->w);
+}
+
+bool suite_bptree(const bench_params *p, suite *s) {
+  int write;
+  bptree_key key = { .integer = bench_workload_next(&s->w, &write) };
+  (void)p;
+  if (write) {
+    bptree_delete(&s->bptree, key, NULL);
+    return bptree_insert(&s->bptree, key, NULL);
+  }
+  return bptree_find(&s->bptree, key, NULL);
+}
+
+void setup_eytzinger(const bench_params *p, suite *s) {
+  int64_t *sorted = malloc((p->size ? p->size : 1) * sizeof(int64_t));
+  setup_workload(p, s);
+  for (size_t i = 0; i < p->size; i++)
+    sorted[i] = 2 * (int64_t)i + 2;
+  mk_eytzinger_kary(&s->eytzinger, sorted, p->size);
+  free(sorted);
+}
+
+void teardown_eytzinger(const bench_params *p, suite *s) {
+  (void)p;
+  destroy_eytzinger_kary(&s->eytzinger);
+  destroy_bench_workload(&s->w);
+}
+
+bool suite_eytzinger(const bench_params *p, suite *s) {
+  int write;
+  int64_t key = bench_workload_next(&s->w, &write);
+  (void)p;
+  return eytzinger_kary_find(&s->eytzinger, key);
+}
+
+void setup_art(const bench_params *p, suite *s) {
+  unsigned char key[8];
+  setup_workload(p, s);
+  mk_art(&s->art);
+  for (size_t i = 0; i < p->size; i++) {
+    art_key(s->w.keys[i], key);
+    art_insert(&s->art, key, sizeof(key), NULL);
+  }
+}
+
+void teardown_art(const bench_params *p, suite *s) {
+  (void)p;
+  destroy_art(&s->art);
+  destroy_bench_workload(&s->w);
+}
+
+bool suite_art(const bench_params *p, suite *s) {
+  int write;
+  unsigned char key[8];
+  void *value;
+  (void)p;
+  art_key(bench_workload_next(&s->w, &write), key);
+  if (write)
+    return art_insert(&s->art, key, sizeof(key), NULL);
+  return art_find(&s->art, key, sizeof(key), &value);
+}
+
+void setup_skiplist(const bench_params *p, suite *s) {
+  setup_workload(p, s);
+  mk_skiplist(&s->skiplist, compare_keys);
+  s->handle = skiplist_join(&s->skiplist);
+  for (size_t i = 0; i < p->size; i++)
+    skiplist_insert(s->handle, as_pointer(s->w.keys[i]), NULL);
+}
+
+void teardown_skiplist(const bench_params *p, suite *s) {
+  (void)p;
+  skiplist_leave(s->handle);
+  destroy_skiplist(&s->skiplist);
+  destroy_bench_workload(&s->w);
+}
+
+bool suite_skiplist(const bench_params *p, suite *s) {
+  int write;
+  int64_t key = bench_workload_next(&s->w, &write);
+  void *value;
+  (void)p;
+  if (write) {
+    skiplist_delete(s->handle, as_pointer(key), NULL);
+    return skiplist_insert(s->handle, as_pointer(key), NULL);
+  }
+  return skiplist_find(s->handle, as_pointer(key), &value);
+}
+
+// The keys are at most 2 * size, so they index a bitmap directly
+void setup_bitmap(const bench_params *p, suite *s) {
+  setup_workload(p, s);
+  s->bitmap = mk_bitmap(2 * p->size + 2);
+  for (size_t i = 0; i < p->size; i++)
+    set_bit(s->bitmap, s->w.keys[i], 1);
+}
+
+void teardown_bitmap(const bench_params *p, suite *s) {
+  (void)p;
+  destroy_bitmap(s->bitmap);
+  destroy_bench_workload(&s->w);
+}
+
+bool suite_bitmap(const bench_params *p, suite *s) {
+  int write;
+  int64_t key = bench_workload_next(&s->w, &write);
+  (void)p;
+  if (write) {
+    set_bit(s->bitmap, key, 0);
+    set_bit(s->bitmap, key, 1);
+    return true;
+  }
+  return bit_set(s->bitmap, key);
+}
+
+static int selected(int argc, char **argv, const char *name) {
+  if (argc <= 2)
+    return 1;
+  for (int i = 2; i < argc; i++)
+    if (!strcmp(argv[i], name))
+      return 1;
+  return 0;
+}
+
+#define run(name, sweep)                                                        \
+  if (selected(argc, argv, #name))                                              \
+    benchmark_sweep(sweep, setup_##name, teardown_##name, suite_##name, &s)
+
+int main(int argc, char **argv) {
+  double max_size = argc > 1 ? strtod(argv[1], NULL) : 1e8;
+  suite s;
+  bench_sweep hashed = {
+    .sizes = bench_geometric(1e3, max_size, 10),
+    .loads = bench_values(0.25, 0.5, 0.7),
+    .distributions = bench_values(BENCH_UNIFORM, BENCH_SEQUENTIAL, BENCH_ZIPFIAN),
+    .reads = bench_values(1, 0.9, 0.5),
+  };
+  bench_sweep ordered = hashed;
+  bench_sweep fixed = hashed;
+  ordered.loads.n = 0;
+  fixed.loads.n = 0;
+  fixed.reads.n = 0;
+
+  run(hashset, &hashed);
+  run(buckets, &hashed);
+  run(rbtree, &ordered);
+  run(bptree, &ordered);
+  run(eytzinger, &fixed);
+  run(art, &ordered);
+  run(skiplist, &ordered);
+  run(bitmap, &ordered);
+  return bench_regressions != 0;
+}
@@ -1,11 +1,86 @@
 #ifndef BENCHMARK_H
 #define BENCHMARK_H
 #include <time.h>
-#include <bsd/sys/time.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(BENCHMARK_CLOCK_GETTIME)
+#define BENCHMARK_RDTSC
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
 
+#if defined(__linux__) && !defined(BENCHMARK_NO_COUNTERS)
+#define BENCHMARK_COUNTERS
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+// Warm-up ends once the time per call of consecutive windows agrees, or after BENCHMARK_WARMUP_MAX_NS
+#ifndef BENCHMARK_WARMUP_MAX_NS
+#define BENCHMARK_WARMUP_MAX_NS 3e9
+#endif
+#define BENCHMARK_WINDOW_NS 1e7
+#define BENCHMARK_STABLE_WINDOWS 3
+#define BENCHMARK_STABLE_TOLERANCE 0.05
+// Time spent measuring after the warm-up
+#ifndef BENCHMARK_TIME_NS
+#define BENCHMARK_TIME_NS 1e9
+#endif
+// Calls are timed in batches long enough that the cost of reading the clock is lost in the noise.
+// Define BENCHMARK_BATCH_NS as 0 to time every call on its own.
+#ifndef BENCHMARK_BATCH_NS
+#define BENCHMARK_BATCH_NS 1e3
+#endif
+#define BENCHMARK_BATCH_OVERHEADS 100
+#define BENCHMARK_HISTOGRAM_BUCKETS 16
+// Machine readable results. When the environment variable BENCHMARK_OUTPUT names a file, a record
+// of every benchmark is appended to it: a JSON object per line, or CSV if the name ends in .csv.
+// When BENCHMARK_BASELINE names a JSON file written by an earlier run, every benchmark is compared
+// with the last record of the same name in it. A slowdown which a Mann-Whitney U test finds
+// significant and which is larger than BENCHMARK_REGRESSION_THRESHOLD is counted in bench_regressions.
+#define BENCHMARK_STORED_SAMPLES 1000
+#ifndef BENCHMARK_REGRESSION_THRESHOLD
+#define BENCHMARK_REGRESSION_THRESHOLD 0.05
+#endif
+// |z| of the U statistic above which a difference is significant; two-sided p < 0.01
+#define BENCHMARK_SIGNIFICANCE_Z 2.576
+#if defined(__clang__)
+#define BENCHMARK_COMPILER "clang " __clang_version__
+#elif defined(__GNUC__)
+#define BENCHMARK_COMPILER "gcc " __VERSION__
+#else
+#define BENCHMARK_COMPILER "unknown"
+#endif
+#define max_runs 10000000
+#define min_runs 10
+#define clamp(x, lo, hi) ((x) < (lo) ? (lo) : (x) > (hi) ? (hi) : (x))
+
+// Keep the compiler from eliding or hoisting benchmarked code: bench_do_not_optimize makes a
+// value look used, and bench_clobber makes every write to memory look observed. A clobber alone
+// does not keep loads whose result is unused, so the harness passes every result through
+// bench_keep, and bench_discard is for functions which return nothing.
+#if defined(__GNUC__)
+#define bench_do_not_optimize(value) __asm__ __volatile__("" : : "r,m"(value) : "memory")
+#define bench_clobber() __asm__ __volatile__("" : : : "memory")
+#define bench_keep(call) bench_do_not_optimize(call)
+#else
+static volatile char bench_sink;
+#define bench_do_not_optimize(value) (bench_sink = *(volatile char*)&(value))
+#define bench_clobber() (bench_sink = 0)
+#define bench_keep(call) (bench_sink = !!(call))
+#endif
+#define bench_discard(call) do { call; bench_clobber(); } while (0)
 
 // avoid linking math just for a sqrt function
 // https://stackoverflow.com/questions/29018864/any-way-to-obtain-square-root-of-a-number-without-using-math-h-and-sqrt
@@ -24,8 +99,8 @@ static inline double sqroot(double square)
 
 static const char divider[] = "================================================================================";
 static inline void print_divider(const char *benchstr) {
-  printf("%.*s\n", (int)strlen(benchstr), divider);                      
-  puts(benchstr);                                                        
+  printf("%.*s\n", (int)strlen(benchstr), divider);
+  puts(benchstr);
 }
 
 static inline size_t utf8_strlen(const char *s){
@@ -46,84 +121,1256 @@ static inline void print_centered(const char *centered_in, const char *value){
   printf("%.*s%s%.*s\n", pad, divider, value, len - pad - value_len, divider);
 }
 
-struct timespec spec_from_double(double t) {
-  struct timespec spec;
-  spec.tv_sec = (time_t)(t / 1e9);
-  spec.tv_nsec = t - (double)spec.tv_sec * 1e9;
-  return spec;
+static inline void readable_time(double ns, char buf[30]){
+  char *units[] = { "s", "ms", "μs", "ns" };
+  if (ns >= 1e9) {
+    snprintf(buf, 30, "%.3f %s", ns * 1e-9, units[0]);
+  } else if (ns >= 1e6) {
+    snprintf(buf, 30, "%.3f %s", ns * 1e-6, units[1]);
+  } else if (ns >= 1e3) {
+    snprintf(buf, 30, "%.3f %s", ns * 1e-3, units[2]);
+  } else {
+    snprintf(buf, 30, "%.1f %s", ns, units[3]);
+  }
 }
 
-void readable_time(struct timespec time, char buf[30]){
-  char *units[] = { "s", "ms", "μs", "ns" };
-  if (time.tv_sec > 0) {
-    snprintf(buf, 30, "%.3f %s", time.tv_sec + time.tv_nsec * 1e-9, units[0]);
-  } else if (time.tv_nsec > 1e6) {
-    snprintf(buf, 30, "%.3f %s", time.tv_nsec * 1e-6, units[1]);
-  } else if (time.tv_nsec > 1e3) {
-    snprintf(buf, 30, "%.3f %s", time.tv_nsec * 1e-3, units[2]);
+// The clock. With an invariant TSC, time is read with rdtsc and converted to nanoseconds with a
+// rate measured against CLOCK_MONOTONIC_RAW; otherwise CLOCK_MONOTONIC_RAW is read directly.
+// CLOCK_MONOTONIC_RAW is not adjusted by NTP. The cost of reading the clock is measured once and
+// subtracted from every sample.
+typedef struct {
+  int calibrated;
+  int rdtsc;
+  double ns_per_tick;
+  double overhead_ns;
+} bench_clock_t;
+
+static bench_clock_t bench_clock;
+
+static inline uint64_t bench_raw_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+  return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static inline uint64_t bench_ticks(void) {
+#ifdef BENCHMARK_RDTSC
+  if (bench_clock.rdtsc) {
+    // keep the read from moving into or out of the timed code
+    _mm_lfence();
+    uint64_t t = __rdtsc();
+    _mm_lfence();
+    return t;
+  }
+#endif
+  return bench_raw_ns();
+}
+
+static inline void bench_calibrate(void) {
+  if (bench_clock.calibrated)
+    return;
+  bench_clock = (bench_clock_t) { .calibrated = 1, .ns_per_tick = 1 };
+#ifdef BENCHMARK_RDTSC
+  unsigned eax, ebx, ecx, edx;
+  if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1 << 8))) {
+    uint64_t ns = bench_raw_ns(), ticks = __rdtsc(), elapsed;
+    while ((elapsed = bench_raw_ns() - ns) < 20000000)
+      ;
+    bench_clock.ns_per_tick = (double)elapsed / (__rdtsc() - ticks);
+    bench_clock.rdtsc = 1;
+  }
+#endif
+  uint64_t least = UINT64_MAX;
+  for (int i = 0; i < 10000; i++) {
+    uint64_t start = bench_ticks(), d = bench_ticks() - start;
+    least = d < least ? d : least;
+  }
+  bench_clock.overhead_ns = least * bench_clock.ns_per_tick;
+}
+
+// Hardware and software event counters, read with perf_event_open while the timed batches run and
+// reported per call. Counters the kernel or the machine does not offer (e.g. hardware counters
+// in most virtual machines, or with a high perf_event_paranoid) are left out of the report.
+// Define BENCHMARK_NO_COUNTERS to skip them altogether.
+enum {
+  BENCH_CYCLES,
+  BENCH_INSTRUCTIONS,
+  BENCH_L1D_MISSES,
+  BENCH_LLC_MISSES,
+  BENCH_BRANCH_MISSES,
+  BENCH_PAGE_FAULTS,
+  BENCH_COUNTERS,
+};
+
+static const char *bench_counter_names[BENCH_COUNTERS] = {
+  "cycles", "instructions", "L1d_misses", "LLC_misses", "branch_misses", "page_faults",
+};
+
+typedef struct {
+  int leader;                    // Descriptor of the group which enables every counter at once
+  int fd[BENCH_COUNTERS];
+  double count[BENCH_COUNTERS];  // Events while timing, or -1 if the counter is unavailable
+} bench_counters_t;
+
+#ifdef BENCHMARK_COUNTERS
+static inline void bench_counters_open(bench_counters_t *c) {
+  const struct { uint32_t type; uint64_t config; } events[BENCH_COUNTERS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+  };
+  c->leader = -1;
+  for (int i = 0; i < BENCH_COUNTERS; i++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.disabled = c->leader < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // the first counter which opens leads the group, so one ioctl starts and stops them all
+    c->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, c->leader, 0);
+    c->leader = c->leader < 0 ? c->fd[i] : c->leader;
+    c->count[i] = -1;
+  }
+}
+
+static inline void bench_counters_start(bench_counters_t *c) {
+  if (c->leader >= 0)
+    ioctl(c->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static inline void bench_counters_stop(bench_counters_t *c) {
+  if (c->leader >= 0)
+    ioctl(c->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static inline void bench_counters_close(bench_counters_t *c) {
+  for (int i = 0; i < BENCH_COUNTERS; i++) {
+    uint64_t value[3];
+    if (c->fd[i] < 0)
+      continue;
+    // if the counters had to share the hardware, scale up from the time this one was running
+    if (read(c->fd[i], value, sizeof(value)) == sizeof(value) && value[2])
+      c->count[i] = (double)value[0] * value[1] / value[2];
+  }
+  for (int i = BENCH_COUNTERS - 1; i >= 0; i--)
+    if (c->fd[i] >= 0)
+      close(c->fd[i]);
+}
+#else
+static inline void bench_counters_open(bench_counters_t *c) {
+  c->leader = -1;
+  for (int i = 0; i < BENCH_COUNTERS; i++)
+    c->count[i] = -1;
+}
+static inline void bench_counters_start(bench_counters_t *c) { (void)c; }
+static inline void bench_counters_stop(bench_counters_t *c) { (void)c; }
+static inline void bench_counters_close(bench_counters_t *c) { (void)c; }
+#endif
+
+// Allocation tracking. Define BENCHMARK_ALLOCATIONS before including benchmark.h, in one file of
+// the program, to replace malloc, calloc, realloc, free and the aligned allocators (posix_memalign,
+// aligned_alloc and memalign) with wrappers which count the blocks
+// and bytes allocated while the timed batches run; they are then reported per call. The wrappers
+// forward to the allocator of glibc, so this needs glibc, and does not mix with sanitizers which
+// replace the allocator themselves. Tests can count the allocations of any code with
+// bench_allocs_reset, bench_allocs_start and bench_allocs_stop, and read bench_allocs.
+typedef struct {
+  int tracked;           // Whether the counts below were taken
+  uint64_t allocations;  // Blocks from malloc, calloc, realloc and the aligned allocators
+  uint64_t frees;        // Blocks released by free and realloc
+  uint64_t bytes;        // Bytes requested
+} bench_allocs_t;
+
+#ifdef BENCHMARK_ALLOCATIONS
+#ifndef __GLIBC__
+#error "BENCHMARK_ALLOCATIONS needs glibc"
+#endif
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+void *__libc_memalign(size_t alignment, size_t size);
+
+static int bench_allocs_on;
+static bench_allocs_t bench_allocs = { .tracked = 1 };
+
+// Relaxed atomics, as threads may allocate at the same time
+#define bench_count_alloc(field, n)                                             \
+  do {                                                                          \
+    if (__atomic_load_n(&bench_allocs_on, __ATOMIC_RELAXED))                    \
+      __atomic_fetch_add(&bench_allocs.field, (n), __ATOMIC_RELAXED);           \
+  } while (0)
+
+void *malloc(size_t size) {
+  bench_count_alloc(allocations, 1);
+  bench_count_alloc(bytes, size);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  bench_count_alloc(allocations, 1);
+  bench_count_alloc(bytes, count * size);
+  return __libc_calloc(count, size);
+}
+
+// A realloc releases the old block and allocates a new one, unless it only frees (size 0)
+void *realloc(void *ptr, size_t size) {
+  if (ptr)
+    bench_count_alloc(frees, 1);
+  if (size || !ptr) {
+    bench_count_alloc(allocations, 1);
+    bench_count_alloc(bytes, size);
+  }
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+  if (ptr)
+    bench_count_alloc(frees, 1);
+  __libc_free(ptr);
+}
+
+void *memalign(size_t alignment, size_t size) {
+  bench_count_alloc(allocations, 1);
+  bench_count_alloc(bytes, size);
+  return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  return memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+  if (!alignment || alignment % sizeof(void*) || (alignment & (alignment - 1)))
+    return EINVAL;
+  void *block = memalign(alignment, size);
+  if (!block)
+    return ENOMEM;
+  *ptr = block;
+  return 0;
+}
+
+static inline void bench_allocs_reset(void) {
+  bench_allocs = (bench_allocs_t) { .tracked = 1 };
+}
+static inline void bench_allocs_start(void) { __atomic_store_n(&bench_allocs_on, 1, __ATOMIC_RELAXED); }
+static inline void bench_allocs_stop(void) { __atomic_store_n(&bench_allocs_on, 0, __ATOMIC_RELAXED); }
+#else
+#define bench_allocs ((bench_allocs_t) { 0 })
+static inline void bench_allocs_reset(void) {}
+static inline void bench_allocs_start(void) {}
+static inline void bench_allocs_stop(void) {}
+#endif
+
+// Peak resident set of the process, reset at the start of every benchmark where Linux allows it
+static inline void bench_reset_peak_rss(void) {
+#ifdef __linux__
+  FILE *f = fopen("/proc/self/clear_refs", "w");
+  if (f) {
+    fputs("5", f);
+    fclose(f);
+  }
+#endif
+}
+
+// Largest resident set in KiB since bench_reset_peak_rss, or over the life of the process where
+// it could not be reset
+static inline long bench_peak_rss(void) {
+  struct rusage usage;
+#ifdef __linux__
+  char line[256];
+  long peak = -1;
+  FILE *f = fopen("/proc/self/status", "r");
+  if (f) {
+    while (fgets(line, sizeof(line), f))
+      if (!strncmp(line, "VmHWM:", 6))
+        peak = atol(line + 6);
+    fclose(f);
+  }
+  if (peak >= 0)
+    return peak;
+#endif
+  return getrusage(RUSAGE_SELF, &usage) ? -1 : usage.ru_maxrss;
+}
+
+typedef struct {
+  char name[640];        // Title of the benchmark in the report
+  char key[512];         // Name of the benchmark in records and baselines: function(arguments) parameters
+  const char *function;
+  const char *arguments;
+  const char *parameters;
+  // warm-up
+  uint64_t warmup_start;
+  size_t window;         // Calls in the next warm-up window
+  double last_window;    // Time per call of the previous window
+  double fixture_ns;     // Time of the setup and teardown around the previous window
+  int stable;            // Consecutive windows which agreed with the previous one
+  // measurement
+  size_t batch;          // Calls timed together in each run
+  size_t runs;
+  uint64_t *samples;     // Clock ticks of each run
+  bench_counters_t counters;
+  bench_allocs_t allocs; // Allocations while timing
+  long peak_rss;         // Largest resident set in KiB during the benchmark
+  int threads;           // Threads running the function at once
+  double ops_per_second; // Calls per second of all threads together
+} bench_state;
+
+// Events per call of a counter over the measurement, or -1 if it is unavailable
+static inline double bench_per_call(const bench_state *s, int counter) {
+  double count = s->counters.count[counter];
+  return count < 0 ? -1 : count / ((double)s->runs * s->batch);
+}
+
+// Print the available counters per call
+static inline void print_counters(const bench_state *s) {
+  double cycles = bench_per_call(s, BENCH_CYCLES), instructions = bench_per_call(s, BENCH_INSTRUCTIONS);
+  int shown = 0;
+  printf("  per call:");
+  for (int i = 0; i < BENCH_COUNTERS; i++) {
+    double value = bench_per_call(s, i);
+    if (value < 0)
+      continue;
+    printf("%s %.3g %s", shown++ ? "," : "", value, bench_counter_names[i]);
+    if (i == BENCH_INSTRUCTIONS && cycles > 0)
+      printf(" (IPC %.2f)", instructions / cycles);
+  }
+  printf("%s\n", shown ? "" : " no counters available");
+}
+
+// Print the allocations per call, if they were tracked, and the peak resident set of the process
+static inline void print_allocations(const bench_state *s) {
+  double calls = (double)s->runs * s->batch;
+  long rss = s->peak_rss;
+  if (s->allocs.tracked)
+    printf("  per call: %.3g allocations, %.3g frees, %.1f bytes; ", s->allocs.allocations / calls,
+        s->allocs.frees / calls, s->allocs.bytes / calls);
+  else
+    printf("  ");
+  printf("peak RSS %.1f MiB\n", rss / 1024.0);
+}
+
+// Time per call of a sample in nanoseconds, with the cost of reading the clock removed
+static inline double bench_ns(const bench_state *s, uint64_t ticks) {
+  double ns = ticks * bench_clock.ns_per_tick - bench_clock.overhead_ns;
+  return ns > 0 ? ns / s->batch : 0;
+}
+
+static inline void bench_begin(bench_state *s, const char *function, const char *arguments, const char *parameters) {
+  bench_calibrate();
+  bench_reset_peak_rss();
+  *s = (bench_state) { .function = function, .arguments = arguments, .parameters = parameters, .window = 1, .threads = 1 };
+  snprintf(s->key, sizeof(s->key), "%s(%s)%s%s", function, arguments, *parameters ? " " : "", parameters);
+  snprintf(s->name, sizeof(s->name), "    Benchmark %s    ", s->key);
+  print_divider(s->name);
+  print_centered(s->name, " WARMING UP ");
+  s->warmup_start = bench_ticks();
+}
+
+// Record a warm-up window of s->window calls which took the given ticks, after a setup and before
+// a teardown which took fixture_ticks. Returns 1 while the warm-up should continue; once it is
+// done, the batch size is chosen and the samples for the measurement are allocated.
+static inline int bench_window(bench_state *s, uint64_t ticks, uint64_t fixture_ticks) {
+  double ns = ticks * bench_clock.ns_per_tick, per_call = ns / s->window;
+  double elapsed = (bench_ticks() - s->warmup_start) * bench_clock.ns_per_tick;
+  double diff = per_call - s->last_window;
+  if (s->last_window > 0 && (diff < 0 ? -diff : diff) <= BENCHMARK_STABLE_TOLERANCE * s->last_window)
+    s->stable++;
+  else
+    s->stable = 0;
+  s->last_window = per_call;
+  s->fixture_ns = fixture_ticks * bench_clock.ns_per_tick;
+  // grow the windows until each takes BENCHMARK_WINDOW_NS
+  if (ns < BENCHMARK_WINDOW_NS && s->window < max_runs) {
+    s->window *= 2;
+    s->stable = 0;
+  }
+  if (s->stable < BENCHMARK_STABLE_WINDOWS && elapsed < BENCHMARK_WARMUP_MAX_NS)
+    return 1;
+
+  double batch_ns = BENCHMARK_BATCH_OVERHEADS * bench_clock.overhead_ns;
+  batch_ns = batch_ns > BENCHMARK_BATCH_NS ? batch_ns : BENCHMARK_BATCH_NS;
+  s->batch = per_call > 0 ? batch_ns / per_call + 1 : max_runs;
+  s->batch = BENCHMARK_BATCH_NS > 0 ? clamp(s->batch, 1, max_runs) : 1;
+  // the fixture runs once per batch and counts against the time budget
+  double per_run = per_call * s->batch + s->fixture_ns;
+  s->runs = per_run > 0 ? BENCHMARK_TIME_NS / per_run : min_runs;
+  s->runs = clamp(s->runs, min_runs, max_runs);
+  s->samples = malloc(s->runs * sizeof(uint64_t));
+  bench_counters_open(&s->counters);
+  print_centered(s->name, " BENCHMARKING ");
+  return 0;
+}
+
+static int bench_compare_u64(const void *left, const void *right) {
+  uint64_t l = *(const uint64_t*)left, r = *(const uint64_t*)right;
+  return (l > r) - (l < r);
+}
+
+// Nearest rank percentile of the sorted samples
+static inline double bench_percentile(const bench_state *s, double p) {
+  size_t rank = (size_t)(p * s->runs + 0.999999);
+  return bench_ns(s, s->samples[rank ? rank - 1 : 0]);
+}
+
+// Print a histogram of the sorted samples over logarithmic buckets from the fastest to the slowest
+static inline void print_histogram(const bench_state *s) {
+  const uint64_t *sorted = s->samples;
+  size_t counts[BENCHMARK_HISTOGRAM_BUCKETS] = {0}, most = 0, i = 0, n = s->runs;
+  double lo = bench_ns(s, sorted[0]), hi = bench_ns(s, sorted[n - 1]), bound[BENCHMARK_HISTOGRAM_BUCKETS + 1];
+  if (lo < 1)
+    lo = 1;
+  if (hi <= lo)
+    hi = lo + 1;
+  // each bucket is (hi / lo)^(1/16) times wider than the one before
+  double ratio = sqroot(sqroot(sqroot(sqroot(hi / lo))));
+  bound[0] = lo;
+  for (int b = 1; b < BENCHMARK_HISTOGRAM_BUCKETS; b++)
+    bound[b] = bound[b - 1] * ratio;
+  bound[BENCHMARK_HISTOGRAM_BUCKETS] = hi;
+  for (int b = 0; b < BENCHMARK_HISTOGRAM_BUCKETS; b++) {
+    while (i < n && (bench_ns(s, sorted[i]) < bound[b + 1] || b == BENCHMARK_HISTOGRAM_BUCKETS - 1)) {
+      counts[b]++;
+      i++;
+    }
+    most = counts[b] > most ? counts[b] : most;
+  }
+  for (int b = 0; b < BENCHMARK_HISTOGRAM_BUCKETS; b++) {
+    char from[30], to[30];
+    readable_time(bound[b], from);
+    readable_time(bound[b + 1], to);
+    int width = most ? (int)(40 * counts[b] / most) : 0;
+    printf("  %12s - %-12s %-40.*s %zu\n", from, to, width, "########################################", counts[b]);
+  }
+}
+
+static int bench_regressions;
+
+typedef struct {
+  char host[64];
+  char cpu[128];
+  char date[32];
+} bench_env_t;
+
+// Where and when the benchmarks ran
+static inline const bench_env_t *bench_env(void) {
+  static bench_env_t env;
+  static int done;
+  if (done)
+    return &env;
+  done = 1;
+  strcpy(env.cpu, "unknown");
+  if (gethostname(env.host, sizeof(env.host)))
+    strcpy(env.host, "unknown");
+  env.host[sizeof(env.host) - 1] = 0;
+  FILE *f = fopen("/proc/cpuinfo", "r");
+  if (f) {
+    char line[256], *colon;
+    while (fgets(line, sizeof(line), f)) {
+      if (!strncmp(line, "model name", 10) && (colon = strchr(line, ':'))) {
+        snprintf(env.cpu, sizeof(env.cpu), "%s", colon + 2);
+        env.cpu[strcspn(env.cpu, "\n")] = 0;
+        break;
+      }
+    }
+    fclose(f);
+  }
+  time_t now = time(NULL);
+  struct tm utc;
+  strftime(env.date, sizeof(env.date), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&now, &utc));
+  return &env;
+}
+
+// Escape c for a JSON string into esc, returning its length
+static inline int bench_json_char(unsigned char c, char esc[7]) {
+  if (c == '"' || c == '\\')
+    return sprintf(esc, "\\%c", c);
+  if (c < 0x20)
+    return sprintf(esc, "\\u%04x", c);
+  esc[0] = c;
+  esc[1] = 0;
+  return 1;
+}
+
+// Write str as a JSON string
+static inline void bench_json_string(FILE *f, const char *str) {
+  char esc[7];
+  fputc('"', f);
+  for (; *str; str++) {
+    bench_json_char(*str, esc);
+    fputs(esc, f);
+  }
+  fputc('"', f);
+}
+
+// If json starts with str written as a JSON string, return the rest of json, otherwise NULL
+static inline const char *bench_json_match(const char *json, const char *str) {
+  char esc[7];
+  if (*json++ != '"')
+    return NULL;
+  for (; *str; str++) {
+    int len = bench_json_char(*str, esc);
+    if (strncmp(json, esc, len))
+      return NULL;
+    json += len;
+  }
+  return *json == '"' ? json + 1 : NULL;
+}
+
+// Write str as a quoted CSV field
+static inline void bench_csv_string(FILE *f, const char *str) {
+  fputc('"', f);
+  for (; *str; str++) {
+    if (*str == '"')
+      fputc('"', f);
+    fputc(*str, f);
+  }
+  fputc('"', f);
+}
+
+// Time per call at n evenly spaced ranks of the sorted samples, which stand in for all of them in
+// records and comparisons. Returns n.
+static inline size_t bench_quantiles(const bench_state *s, double *out) {
+  size_t n = s->runs < BENCHMARK_STORED_SAMPLES ? s->runs : BENCHMARK_STORED_SAMPLES;
+  for (size_t i = 0; i < n; i++)
+    out[i] = bench_ns(s, s->samples[(2 * i + 1) * s->runs / (2 * n)]);
+  return n;
+}
+
+// Append a record of a finished benchmark to the file named by BENCHMARK_OUTPUT
+static inline void bench_record(const bench_state *s, double mean, double stddev) {
+  const char *path = getenv("BENCHMARK_OUTPUT");
+  if (!path || !*path)
+    return;
+  FILE *f = fopen(path, "a");
+  if (!f) {
+    perror(path);
+    return;
+  }
+  const bench_env_t *env = bench_env();
+  const char *clock = bench_clock.rdtsc ? "rdtsc" : "CLOCK_MONOTONIC_RAW";
+  double p[] = {
+    bench_ns(s, s->samples[0]), bench_percentile(s, 0.5), bench_percentile(s, 0.9),
+    bench_percentile(s, 0.99), bench_percentile(s, 0.999), bench_ns(s, s->samples[s->runs - 1]),
+  };
+  double calls = (double)s->runs * s->batch;
+  size_t len = strlen(path);
+  if (len >= 4 && !strcmp(path + len - 4, ".csv")) {
+    if (ftell(f) == 0) {
+      fprintf(f, "function,arguments,parameters,threads,ops_per_second,batches,batch,mean_ns,stddev_ns,min_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,");
+      for (int i = 0; i < BENCH_COUNTERS; i++)
+        fprintf(f, "%s_per_call,", bench_counter_names[i]);
+      fprintf(f, "allocations_per_call,frees_per_call,bytes_per_call,peak_rss_kb,clock,overhead_ns,host,cpu,compiler,date\n");
+    }
+    bench_csv_string(f, s->function);
+    fputc(',', f);
+    bench_csv_string(f, s->arguments);
+    fputc(',', f);
+    bench_csv_string(f, s->parameters);
+    fprintf(f, ",%d,%.1f", s->threads, s->ops_per_second);
+    fprintf(f, ",%zu,%zu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,",
+        s->runs, s->batch, mean, stddev, p[0], p[1], p[2], p[3], p[4], p[5]);
+    // unavailable counters are empty fields
+    for (int i = 0; i < BENCH_COUNTERS; i++) {
+      if (bench_per_call(s, i) >= 0)
+        fprintf(f, "%.3f", bench_per_call(s, i));
+      fputc(',', f);
+    }
+    // untracked allocations are empty fields
+    if (s->allocs.tracked)
+      fprintf(f, "%.3f,%.3f,%.3f,", s->allocs.allocations / calls, s->allocs.frees / calls, s->allocs.bytes / calls);
+    else
+      fprintf(f, ",,,");
+    fprintf(f, "%ld,%s,%.3f,", s->peak_rss, clock, bench_clock.overhead_ns);
+    bench_csv_string(f, env->host);
+    fputc(',', f);
+    bench_csv_string(f, env->cpu);
+    fputc(',', f);
+    bench_csv_string(f, BENCHMARK_COMPILER);
+    fprintf(f, ",%s\n", env->date);
   } else {
-    snprintf(buf, 30, "%ld %s", time.tv_nsec, units[3]);
+    double stored[BENCHMARK_STORED_SAMPLES];
+    size_t n = bench_quantiles(s, stored);
+    fprintf(f, "{\"name\":");
+    bench_json_string(f, s->key);
+    fprintf(f, ",\"function\":");
+    bench_json_string(f, s->function);
+    fprintf(f, ",\"arguments\":");
+    bench_json_string(f, s->arguments);
+    fprintf(f, ",\"parameters\":");
+    bench_json_string(f, s->parameters);
+    fprintf(f, ",\"threads\":%d,\"ops_per_second\":%.1f", s->threads, s->ops_per_second);
+    fprintf(f, ",\"batches\":%zu,\"batch\":%zu,\"mean_ns\":%.3f,\"stddev_ns\":%.3f,\"min_ns\":%.3f,\"p50_ns\":%.3f"
+               ",\"p90_ns\":%.3f,\"p99_ns\":%.3f,\"p999_ns\":%.3f,\"max_ns\":%.3f,\"clock\":\"%s\",\"overhead_ns\":%.3f",
+        s->runs, s->batch, mean, stddev, p[0], p[1], p[2], p[3], p[4], p[5], clock, bench_clock.overhead_ns);
+    // unavailable counters are null
+    for (int i = 0; i < BENCH_COUNTERS; i++) {
+      if (bench_per_call(s, i) >= 0)
+        fprintf(f, ",\"%s_per_call\":%.3f", bench_counter_names[i], bench_per_call(s, i));
+      else
+        fprintf(f, ",\"%s_per_call\":null", bench_counter_names[i]);
+    }
+    if (s->allocs.tracked)
+      fprintf(f, ",\"allocations_per_call\":%.3f,\"frees_per_call\":%.3f,\"bytes_per_call\":%.3f",
+          s->allocs.allocations / calls, s->allocs.frees / calls, s->allocs.bytes / calls);
+    else
+      fprintf(f, ",\"allocations_per_call\":null,\"frees_per_call\":null,\"bytes_per_call\":null");
+    fprintf(f, ",\"peak_rss_kb\":%ld", s->peak_rss);
+    fprintf(f, ",\"host\":");
+    bench_json_string(f, env->host);
+    fprintf(f, ",\"cpu\":");
+    bench_json_string(f, env->cpu);
+    fprintf(f, ",\"compiler\":");
+    bench_json_string(f, BENCHMARK_COMPILER);
+    fprintf(f, ",\"date\":\"%s\",\"samples\":[", env->date);
+    for (size_t i = 0; i < n; i++)
+      fprintf(f, "%s%.3f", i ? "," : "", stored[i]);
+    fprintf(f, "]}\n");
   }
+  fclose(f);
 }
 
-static inline void print_summary(const char *benchstr, const struct timespec *m, int n) {
-  struct timespec sum = {0};
-  double mean, stddev, stderr, total_us;
-  for (int i = 0; i < n; i++) {
-    timespecadd(&sum, &m[i], &sum);
+// Read the stored samples of the last record with the given name in a JSON baseline. Returns how many were read.
+static inline size_t bench_load_baseline(const char *path, const char *name, double *out) {
+  char *line = NULL;
+  const char *rest;
+  size_t cap = 0, n = 0;
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return 0;
+  while (getline(&line, &cap, f) > 0) {
+    char *samples = strstr(line, ",\"samples\":[");
+    if (strncmp(line, "{\"name\":", 8) || !(rest = bench_json_match(line + 8, name)) || *rest != ',' || !samples)
+      continue;
+    char *end = samples + strlen(",\"samples\":[");
+    for (n = 0; n < BENCHMARK_STORED_SAMPLES && *end != ']'; n++) {
+      char *p = end;
+      out[n] = strtod(p, &end);
+      if (end == p)
+        break;
+      if (*end == ',')
+        end++;
+    }
   }
+  free(line);
+  fclose(f);
+  return n;
+}
+
+typedef struct {
+  double value;
+  int baseline;
+} bench_ranked;
+
+static int bench_compare_ranked(const void *left, const void *right) {
+  double l = ((const bench_ranked*)left)->value, r = ((const bench_ranked*)right)->value;
+  return (l > r) - (l < r);
+}
 
-  total_us = sum.tv_sec * 1e9 + sum.tv_nsec;
-  mean = total_us / n;
-  stddev = 0;
-  for (int i = 0; i < n; i++) {
-    double diff = (m[i].tv_sec * 1e9 + m[i].tv_nsec) - mean;
-    stddev += diff * diff;
+// z score of the Mann-Whitney U statistic of a against b, with ties and continuity corrected.
+// It is positive when the values of a tend to be larger than those of b.
+static inline double bench_mann_whitney(const double *a, size_t n, const double *b, size_t m) {
+  size_t total = n + m;
+  bench_ranked *r = malloc(total * sizeof(bench_ranked));
+  double rank_sum = 0, ties = 0;
+  for (size_t i = 0; i < n; i++)
+    r[i] = (bench_ranked) { a[i], 0 };
+  for (size_t i = 0; i < m; i++)
+    r[n + i] = (bench_ranked) { b[i], 1 };
+  qsort(r, total, sizeof(bench_ranked), bench_compare_ranked);
+  for (size_t i = 0, j; i < total; i = j) {
+    // equal values share the average of their ranks
+    for (j = i; j < total && r[j].value == r[i].value; j++)
+      ;
+    double t = j - i, rank = (i + 1 + j) / 2.0;
+    ties += t * t * t - t;
+    for (size_t k = i; k < j; k++)
+      rank_sum += r[k].baseline ? 0 : rank;
   }
+  free(r);
+  double u = rank_sum - n * (n + 1) / 2.0, d = u - n * m / 2.0;
+  double variance = n * m / 12.0 * (total + 1 - ties / (total * (total - 1.0)));
+  if (variance <= 0)
+    return 0;
+  d = d > 0.5 ? d - 0.5 : d < -0.5 ? d + 0.5 : 0;
+  return d / sqroot(variance);
+}
 
-  stderr = sqroot(stddev / n);
-  
-  char buf[100];
-  char mean_s[30];
-  char err_s[30];
-  struct timespec mean_spec = spec_from_double(mean);
-  struct timespec err_spec = spec_from_double(stderr);
-  readable_time(mean_spec, mean_s);
-  readable_time(err_spec, err_s);
+// Compare a finished benchmark with its record in the file named by BENCHMARK_BASELINE
+static inline void bench_compare_baseline(const bench_state *s) {
+  const char *path = getenv("BENCHMARK_BASELINE");
+  char was[30], is[30];
+  double current[BENCHMARK_STORED_SAMPLES], baseline[BENCHMARK_STORED_SAMPLES];
+  if (!path || !*path)
+    return;
+  size_t n = bench_quantiles(s, current), m = bench_load_baseline(path, s->key, baseline);
+  if (!m) {
+    printf("  no baseline in %s\n", path);
+    return;
+  }
+  // the stored samples are sorted, so their middle is the median
+  double before = (baseline[(m - 1) / 2] + baseline[m / 2]) / 2, after = (current[(n - 1) / 2] + current[n / 2]) / 2;
+  double change = before > 0 ? (after - before) / before : 0, z = bench_mann_whitney(current, n, baseline, m);
+  const char *verdict = "no significant change";
+  if (z > BENCHMARK_SIGNIFICANCE_Z && change > BENCHMARK_REGRESSION_THRESHOLD) {
+    verdict = "REGRESSION";
+    bench_regressions++;
+  } else if (z < -BENCHMARK_SIGNIFICANCE_Z && change < -BENCHMARK_REGRESSION_THRESHOLD) {
+    verdict = "improvement";
+  }
+  readable_time(before, was);
+  readable_time(after, is);
+  printf("  baseline p50 %s -> %s (%+.1f%%), z = %.2f: %s\n", was, is, 100 * change, z, verdict);
+}
 
-  snprintf(buf, 100, " %s ± %s ", mean_s, err_s);
-  print_centered(benchstr, buf);
-  printf("%.*s\n", (int)strlen(benchstr), divider);                      
+// Sort the samples, and compute their mean and standard deviation per call
+static inline void bench_moments(bench_state *s, double *mean, double *stddev) {
+  uint64_t *m = s->samples;
+  size_t n = s->runs;
+  *mean = *stddev = 0;
+  qsort(m, n, sizeof(uint64_t), bench_compare_u64);
+  for (size_t i = 0; i < n; i++)
+    *mean += bench_ns(s, m[i]);
+  *mean /= n;
+  for (size_t i = 0; i < n; i++) {
+    double diff = bench_ns(s, m[i]) - *mean;
+    *stddev += diff * diff;
+  }
+  *stddev = sqroot(*stddev / n);
+  if (!s->ops_per_second && *mean > 0)
+    s->ops_per_second = 1e9 / *mean;
 }
-#define max_runs 10000000
-#define min_runs 10
-#define clamp(x, lo, hi) ((x) < (lo) ? (lo) : (x) > (hi) ? (hi) : (x))
-#define benchmark(fname, ...)                                                 \
+
+static inline void print_summary(bench_state *s) {
+  uint64_t *m = s->samples;
+  size_t n = s->runs;
+  double mean, stddev;
+  char buf[200], mean_s[30], stddev_s[30], p[6][30];
+
+  s->peak_rss = bench_peak_rss();
+  bench_moments(s, &mean, &stddev);
+
+  readable_time(mean, mean_s);
+  readable_time(stddev, stddev_s);
+  snprintf(buf, sizeof(buf), " %s ± %s ", mean_s, stddev_s);
+  print_centered(s->name, buf);
+
+  readable_time(bench_ns(s, m[0]), p[0]);
+  readable_time(bench_percentile(s, 0.5), p[1]);
+  readable_time(bench_percentile(s, 0.9), p[2]);
+  readable_time(bench_percentile(s, 0.99), p[3]);
+  readable_time(bench_percentile(s, 0.999), p[4]);
+  readable_time(bench_ns(s, m[n - 1]), p[5]);
+  printf("  batches %zu of %zu calls, clock %s, overhead %.1f ns subtracted\n", n, s->batch, bench_clock.rdtsc ? "rdtsc" : "CLOCK_MONOTONIC_RAW", bench_clock.overhead_ns);
+  printf("  min %s  p50 %s  p90 %s  p99 %s  p99.9 %s  max %s\n", p[0], p[1], p[2], p[3], p[4], p[5]);
+
+  // Tukey's fences: mild outliers are beyond 1.5 interquartile ranges from the quartiles, severe beyond 3
+  double q1 = bench_percentile(s, 0.25), q3 = bench_percentile(s, 0.75), iqr = q3 - q1;
+  size_t low_severe = 0, low_mild = 0, high_mild = 0, high_severe = 0;
+  for (size_t i = 0; i < n; i++) {
+    double t = bench_ns(s, m[i]);
+    low_severe += t < q1 - 3 * iqr;
+    low_mild += t >= q1 - 3 * iqr && t < q1 - 1.5 * iqr;
+    high_mild += t > q3 + 1.5 * iqr && t <= q3 + 3 * iqr;
+    high_severe += t > q3 + 3 * iqr;
+  }
+  size_t outliers = low_severe + low_mild + high_mild + high_severe;
+  printf("  outliers %zu (%.1f%%): %zu low severe, %zu low mild, %zu high mild, %zu high severe\n",
+      outliers, 100.0 * outliers / n, low_severe, low_mild, high_mild, high_severe);
+  print_histogram(s);
+  bench_counters_close(&s->counters);
+  print_counters(s);
+  print_allocations(s);
+  bench_compare_baseline(s);
+  bench_record(s, mean, stddev);
+  printf("%.*s\n", (int)strlen(s->name), divider);
+  free(s->samples);
+}
+// Parameterized benchmarks. A sweep lists the values of each parameter, and benchmark_sweep runs
+// every combination of them. A bench_workload turns the parameters into keys and a trace of
+// operations over them, so different structures can be run on the same workload.
+typedef enum { BENCH_UNIFORM, BENCH_SEQUENTIAL, BENCH_ZIPFIAN, BENCH_DISTRIBUTIONS } bench_distribution;
+
+static const char *bench_distribution_names[BENCH_DISTRIBUTIONS] = { "uniform", "sequential", "zipfian" };
+
+// Skew of the Zipfian distribution
+#ifndef BENCHMARK_ZIPF_THETA
+#define BENCHMARK_ZIPF_THETA 0.99
+#endif
+// Longest trace of operations; longer runs go through it again
+#define BENCHMARK_TRACE_MAX (1 << 22)
+#define BENCHMARK_SWEEP_MAX 16
+
+typedef struct {
+  size_t size;                      // Keys in the structure
+  double load;                      // Load factor, for structures which have one; 0 if it is not swept
+  bench_distribution distribution;  // How the operations pick their keys
+  double reads;                     // Fraction of operations which look a key up; the others write it
+} bench_params;
+
+typedef struct {
+  double values[BENCHMARK_SWEEP_MAX];
+  size_t n;
+} bench_list;
+
+// Values of each parameter. An empty list leaves its parameter at the default: 1000 keys, no load
+// factor, uniform keys and only reads.
+typedef struct {
+  bench_list sizes;
+  bench_list loads;
+  bench_list distributions;
+  bench_list reads;
+} bench_sweep;
+
+// A list of the given values
+#define bench_values(...) \
+  ((bench_list) { { __VA_ARGS__ }, sizeof((double[]) { __VA_ARGS__ }) / sizeof(double) })
+
+// The values from lo to hi, each factor times the one before
+static inline bench_list bench_geometric(double lo, double hi, double factor) {
+  bench_list l = {0};
+  for (double v = lo; v <= hi * 1.000001 && l.n < BENCHMARK_SWEEP_MAX; v *= factor)
+    l.values[l.n++] = v;
+  return l;
+}
+
+// Set p to combination k of the sweep, returning 0 once every combination has been visited
+static inline int bench_sweep_next(const bench_sweep *s, size_t k, bench_params *p) {
+  const bench_list *lists[] = { &s->sizes, &s->loads, &s->distributions, &s->reads };
+  double values[] = { 1000, 0, BENCH_UNIFORM, 1 };
+  for (int i = 3; i >= 0; i--) {
+    size_t n = lists[i]->n ? lists[i]->n : 1;
+    if (lists[i]->n)
+      values[i] = lists[i]->values[k % n];
+    k /= n;
+  }
+  if (k)
+    return 0;
+  *p = (bench_params) { .size = values[0], .load = values[1], .distribution = (bench_distribution)values[2], .reads = values[3] };
+  return 1;
+}
+
+static inline void bench_params_format(const bench_params *p, char *buf, size_t len) {
+  char load[32] = "";
+  if (p->load > 0)
+    snprintf(load, sizeof(load), " load=%.2f", p->load);
+  snprintf(buf, len, "[size=%zu%s keys=%s reads=%.2f]", p->size, load, bench_distribution_names[p->distribution], p->reads);
+}
+
+// xorshift64*
+static inline uint64_t bench_random(uint64_t *state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 2685821657736338717ull;
+}
+
+// Uniform in [0, 1)
+static inline double bench_random_unit(uint64_t *state) {
+  return (bench_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Natural logarithm and exponential, for the same reason as sqroot. x = m 2^e with m near 1, and
+// log m = 2 atanh((m - 1) / (m + 1)) is summed until the terms vanish.
+static inline double bench_log(double x) {
+  uint64_t bits;
+  if (x <= 0)
+    return -1e308;
+  memcpy(&bits, &x, sizeof(bits));
+  int e = (int)((bits >> 52) & 0x7ff) - 1023;
+  bits = (bits & ~(0x7ffull << 52)) | (1023ull << 52);
+  double m, sum = 0;
+  memcpy(&m, &bits, sizeof(m));
+  if (m > 1.4142135623730951) {
+    m /= 2;
+    e++;
+  }
+  double z = (m - 1) / (m + 1), term = z;
+  for (int k = 1; term > 1e-18 || term < -1e-18; k += 2, term *= z * z)
+    sum += term / k;
+  return e * 0.6931471805599453 + 2 * sum;
+}
+
+// e^x = 2^k e^r with |r| <= log(2) / 2, and e^r is a Taylor series
+static inline double bench_exp(double x) {
+  if (x > 709)
+    return 1e308;
+  if (x < -708)
+    return 0;
+  int k = (int)(x / 0.6931471805599453 + (x < 0 ? -0.5 : 0.5));
+  double r = x - k * 0.6931471805599453, sum = 1, term = 1, scale;
+  for (int i = 1; term > 1e-18 || term < -1e-18; i++)
+    sum += term *= r / i;
+  uint64_t bits = (uint64_t)(k + 1023) << 52;
+  memcpy(&scale, &bits, sizeof(scale));
+  return sum * scale;
+}
+
+static inline double bench_pow(double x, double y) {
+  return x > 0 ? bench_exp(y * bench_log(x)) : 0;
+}
+
+// Ranks of a Zipfian distribution over n items, by the method of Gray et al, "Quickly generating
+// billion-record synthetic databases". Rank 0 is the most popular.
+typedef struct {
+  size_t n;
+  double theta, alpha, zetan, eta, half_pow_theta;
+} bench_zipf;
+
+static inline void mk_bench_zipf(bench_zipf *z, size_t n, double theta) {
+  // sum i^-theta exactly for the first terms, and approximate the rest by an integral
+  size_t exact = n < 10000 ? n : 10000;
+  double zetan = 0, zeta2 = 1 + bench_pow(2, -theta);
+  for (size_t i = 1; i <= exact; i++)
+    zetan += bench_pow(i, -theta);
+  if (n > exact)
+    zetan += (bench_pow(n + 0.5, 1 - theta) - bench_pow(exact + 0.5, 1 - theta)) / (1 - theta);
+  *z = (bench_zipf) {
+    .n = n,
+    .theta = theta,
+    .alpha = 1 / (1 - theta),
+    .zetan = zetan,
+    // only ranks past the first two use eta, and for n = 2 it would be 0/0
+    .eta = n > 2 ? (1 - bench_pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan) : 0,
+    .half_pow_theta = bench_pow(0.5, theta),
+  };
+}
+
+static inline size_t bench_zipf_next(const bench_zipf *z, uint64_t *state) {
+  double u = bench_random_unit(state), uz = u * z->zetan;
+  if (uz < 1)
+    return 0;
+  if (uz < 1 + z->half_pow_theta)
+    return 1;
+  size_t rank = z->n * bench_pow(z->eta * u - z->eta + 1, z->alpha);
+  return rank < z->n ? rank : z->n - 1;
+}
+
+typedef struct {
+  bench_params params;
+  int64_t *keys;    // The even numbers from 2 to 2 * size in random order; odd numbers are never keys
+  int64_t *trace;   // Keys of the operations, plus one for the operations which write
+  size_t length;
+  size_t next;
+} bench_workload;
+
+// Draw keys and a trace of operations for the parameters. Writes are chosen with probability
+// 1 - reads; what a write does is up to the structure, but it should leave the same keys in it.
+static inline void mk_bench_workload(bench_workload *w, const bench_params *p, uint64_t seed) {
+  uint64_t state = seed ? seed : 88172645463325252ull;
+  size_t n = p->size ? p->size : 1;
+  bench_zipf zipf;
+  *w = (bench_workload) { .params = *p, .length = n < BENCHMARK_TRACE_MAX ? n : BENCHMARK_TRACE_MAX };
+  w->length = w->length < 65536 ? 65536 : w->length;
+  w->keys = malloc(n * sizeof(int64_t));
+  w->trace = malloc(w->length * sizeof(int64_t));
+  for (size_t i = 0; i < n; i++)
+    w->keys[i] = 2 * (int64_t)i + 2;
+  for (size_t i = n - 1; i > 0; i--) {
+    size_t j = bench_random(&state) % (i + 1);
+    int64_t t = w->keys[i];
+    w->keys[i] = w->keys[j];
+    w->keys[j] = t;
+  }
+  if (p->distribution == BENCH_ZIPFIAN)
+    mk_bench_zipf(&zipf, n, BENCHMARK_ZIPF_THETA);
+  for (size_t i = 0; i < w->length; i++) {
+    int64_t key;
+    if (p->distribution == BENCH_SEQUENTIAL)
+      key = 2 * (int64_t)(i % n) + 2;
+    else if (p->distribution == BENCH_ZIPFIAN)
+      key = w->keys[bench_zipf_next(&zipf, &state)];
+    else
+      key = w->keys[bench_random(&state) % n];
+    w->trace[i] = key + (bench_random_unit(&state) >= p->reads);
+  }
+}
+
+static inline void destroy_bench_workload(bench_workload *w) {
+  free(w->keys);
+  free(w->trace);
+}
+
+// Key of the next operation, and whether it writes
+static inline int64_t bench_workload_next(bench_workload *w, int *write) {
+  int64_t key = w->trace[w->next];
+  w->next = w->next + 1 < w->length ? w->next + 1 : 0;
+  *write = key & 1;
+  return key & ~(int64_t)1;
+}
+
+// Multi-threaded throughput. op(data, thread) runs on several threads at once, each pinned to a cpu
+// of its own where there are enough. setup(data, thread) runs on each thread before the threads
+// start together at a barrier, and teardown(data, thread) after they are done; both may be NULL.
+// Each thread times batches of calls for BENCHMARK_TIME_NS. The run is repeated for 1, 2, 4, ...
+// threads up to max_threads (0: one per online cpu), and every thread count is reported, recorded
+// and compared with the baseline as its own benchmark.
+typedef void (*bench_thread_op)(void *data, int thread);
+
+typedef struct {
+  int id;
+  int cpu;                  // cpu the thread is pinned to, or -1
+  bench_thread_op op, setup, teardown;
+  void *data;
+  pthread_barrier_t *start;
+  size_t batch;
+  size_t runs;              // Batches timed
+  size_t capacity;
+  uint64_t *samples;
+  uint64_t begin, end;      // Clock ticks when the thread started and stopped timing
+} bench_thread;
+
+// Pin the calling thread to the n-th cpu it may run on, wrapping around. Returns the cpu or -1.
+static inline int bench_pin(int n) {
+#ifdef __linux__
+  unsigned long mask[16] = {0}, pin[16] = {0};
+  int cpus[16 * 64], count = 0;
+  if (syscall(SYS_sched_getaffinity, 0, sizeof(mask), mask) < 0)
+    return -1;
+  for (int cpu = 0; cpu < 16 * 64; cpu++)
+    if (mask[cpu / 64] >> (cpu % 64) & 1)
+      cpus[count++] = cpu;
+  if (!count)
+    return -1;
+  int cpu = cpus[n % count];
+  pin[cpu / 64] = 1ul << (cpu % 64);
+  return syscall(SYS_sched_setaffinity, 0, sizeof(pin), pin) < 0 ? -1 : cpu;
+#else
+  (void)n;
+  return -1;
+#endif
+}
+
+static inline void *bench_thread_main(void *arg) {
+  bench_thread *t = arg;
+  t->cpu = bench_pin(t->id);
+  if (t->setup)
+    t->setup(t->data, t->id);
+  pthread_barrier_wait(t->start);
+  uint64_t start = bench_ticks(), now = start;
+  uint64_t stop = start + (uint64_t)(BENCHMARK_TIME_NS / bench_clock.ns_per_tick);
+  t->begin = start;
+  while (now < stop && t->runs < t->capacity) {
+    start = now;
+    for (size_t i = 0; i < t->batch; i++) {
+      t->op(t->data, t->id);
+      bench_clobber();
+    }
+    now = bench_ticks();
+    t->samples[t->runs++] = now - start;
+  }
+  t->end = now;
+  if (t->teardown)
+    t->teardown(t->data, t->id);
+  return NULL;
+}
+
+// Run every thread count and print the scaling curve
+static inline void bench_threads(const char *function, const char *arguments, int max_threads,
+    bench_thread_op setup, bench_thread_op teardown, bench_thread_op op, void *data) {
+  char parameters[64];
+  bench_state warmup;
+  double base = 0;
+  if (max_threads <= 0)
+    max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  // size the batches on one thread, like benchmark does
+  bench_begin(&warmup, function, arguments, "[threads]");
+  if (setup)
+    setup(data, 0);
+  uint64_t start;
+  do {
+    start = bench_ticks();
+    for (size_t i = 0; i < warmup.window; i++) {
+      op(data, 0);
+      bench_clobber();
+    }
+  } while (bench_window(&warmup, bench_ticks() - start, 0));
+  if (teardown)
+    teardown(data, 0);
+  bench_counters_close(&warmup.counters);
+  free(warmup.samples);
+  printf("  %7s %12s %8s %10s %12s %12s %12s\n", "threads", "Mops/s", "speedup", "efficiency", "p50", "p99", "p99.9");
+
+  for (int threads = 1; threads <= max_threads; threads = threads < max_threads && 2 * threads > max_threads ? max_threads : 2 * threads) {
+    bench_thread *t = calloc(threads, sizeof(bench_thread));
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    pthread_barrier_t barrier;
+    bench_state all;
+    double mean, stddev;
+    char p[3][30];
+    // per thread, the batches the time budget allows with room to spare
+    size_t capacity = warmup.runs * 2 + min_runs;
+    bench_reset_peak_rss();
+    pthread_barrier_init(&barrier, NULL, threads + 1);
+    for (int i = 0; i < threads; i++) {
+      t[i] = (bench_thread) { .id = i, .op = op, .setup = setup, .teardown = teardown, .data = data,
+        .start = &barrier, .batch = warmup.batch, .capacity = capacity };
+      t[i].samples = malloc(capacity * sizeof(uint64_t));
+      pthread_create(&ids[i], NULL, bench_thread_main, &t[i]);
+    }
+    // the threads are set up once they all reach the barrier; the count includes their teardowns
+    bench_allocs_reset();
+    bench_allocs_start();
+    pthread_barrier_wait(&barrier);
+    for (int i = 0; i < threads; i++)
+      pthread_join(ids[i], NULL);
+    bench_allocs_stop();
+    pthread_barrier_destroy(&barrier);
+
+    // all samples together make the benchmark of this thread count
+    snprintf(parameters, sizeof(parameters), "[threads=%d]", threads);
+    all = (bench_state) { .function = function, .arguments = arguments, .parameters = parameters,
+      .batch = warmup.batch, .threads = threads, .allocs = bench_allocs };
+    snprintf(all.key, sizeof(all.key), "%s(%s) %s", function, arguments, parameters);
+    for (int i = 0; i < BENCH_COUNTERS; i++)
+      all.counters.count[i] = -1;
+    uint64_t begin = UINT64_MAX, end = 0;
+    for (int i = 0; i < threads; i++) {
+      all.runs += t[i].runs;
+      begin = t[i].begin < begin ? t[i].begin : begin;
+      end = t[i].end > end ? t[i].end : end;
+    }
+    all.samples = malloc((all.runs ? all.runs : 1) * sizeof(uint64_t));
+    all.runs = 0;
+    for (int i = 0; i < threads; i++) {
+      memcpy(all.samples + all.runs, t[i].samples, t[i].runs * sizeof(uint64_t));
+      all.runs += t[i].runs;
+    }
+    all.ops_per_second = (double)all.runs * all.batch / ((end - begin) * bench_clock.ns_per_tick * 1e-9);
+    if (!all.runs) {
+      free(all.samples);
+      free(ids);
+      free(t);
+      continue;
+    }
+    all.peak_rss = bench_peak_rss();
+    bench_moments(&all, &mean, &stddev);
+    base = threads == 1 ? all.ops_per_second : base;
+    readable_time(bench_percentile(&all, 0.5), p[0]);
+    readable_time(bench_percentile(&all, 0.99), p[1]);
+    readable_time(bench_percentile(&all, 0.999), p[2]);
+    printf("  %7d %12.3f %8.2f %9.0f%% %12s %12s %12s\n", threads, all.ops_per_second * 1e-6,
+        all.ops_per_second / base, 100 * all.ops_per_second / base / threads, p[0], p[1], p[2]);
+    print_allocations(&all);
+
+    // latency per call of each thread
+    for (int i = 0; threads > 1 && i < threads; i++) {
+      bench_state one = { .batch = t[i].batch, .runs = t[i].runs, .samples = t[i].samples };
+      if (!one.runs)
+        continue;
+      qsort(one.samples, one.runs, sizeof(uint64_t), bench_compare_u64);
+      readable_time(bench_percentile(&one, 0.5), p[0]);
+      readable_time(bench_percentile(&one, 0.99), p[1]);
+      readable_time(bench_percentile(&one, 0.999), p[2]);
+      printf("  %7s %12.3f %8s %10s %12s %12s %12s  thread %d on cpu %d\n", "",
+          one.runs * one.batch / ((t[i].end - t[i].begin) * bench_clock.ns_per_tick * 1e-9) * 1e-6, "", "",
+          p[0], p[1], p[2], i, t[i].cpu);
+    }
+    bench_compare_baseline(&all);
+    bench_record(&all, mean, stddev);
+    free(all.samples);
+    for (int i = 0; i < threads; i++)
+      free(t[i].samples);
+    free(ids);
+    free(t);
+  }
+  printf("%.*s\n", (int)strlen(warmup.name), divider);
+}
+
+// Stands in for a missing setup or teardown
+#define bench_nothing(...) ((void)0)
+
+// Time fname(...). Each sample is the time per call of a batch of calls, sized during the warm-up.
+// The result of every call is kept, so use benchmark_void for functions which return nothing.
+#define benchmark(fname, ...) \
+  bench_run(bench_keep, #fname, #__VA_ARGS__, "", bench_nothing, bench_nothing, fname, __VA_ARGS__)
+
+#define benchmark_void(fname, ...) \
+  bench_run(bench_discard, #fname, #__VA_ARGS__, "", bench_nothing, bench_nothing, fname, __VA_ARGS__)
+
+// Time fname(...) with setup(...) run before and teardown(...) run after each batch of calls and
+// each warm-up window, outside the timed region. fname is called repeatedly on whatever setup
+// prepared, so this suits functions which change it, e.g. inserts which must start from empty.
+#define benchmark_fixture(setup, teardown, fname, ...) \
+  bench_run(bench_keep, #fname, #__VA_ARGS__, "", setup, teardown, fname, __VA_ARGS__)
+
+#define benchmark_fixture_void(setup, teardown, fname, ...) \
+  bench_run(bench_discard, #fname, #__VA_ARGS__, "", setup, teardown, fname, __VA_ARGS__)
+
+// Time fname(...) with setup(...) run once before the benchmark and teardown(...) once after it.
+// For functions which leave what setup prepared unchanged, e.g. lookups.
+#define benchmark_setup(setup, teardown, fname, ...)                          \
 {                                                                             \
-const char _m_testname[] = "    Benchmark " #fname "(" #__VA_ARGS__ ")    ";  \
-print_divider(_m_testname);                                                   \
-print_centered(_m_testname, " WARMING UP ");                                  \
-struct timespec _m_start, _m_now, _m_elapsed;                                 \
-clock_gettime(CLOCK_REALTIME, &_m_start);                                     \
-int _m_runs = 0;                                                              \
-while (1) {                                                                   \
-  clock_gettime(CLOCK_REALTIME, &_m_now);                                     \
-  timespecsub(&_m_now, &_m_start, &_m_elapsed);                               \
-  if (_m_elapsed.tv_sec >= 3) break;                                          \
-  (void)fname(__VA_ARGS__);                                                   \
-  _m_runs++;                                                                  \
+setup(__VA_ARGS__);                                                           \
+bench_run(bench_keep, #fname, #__VA_ARGS__, "", bench_nothing, bench_nothing, \
+          fname, __VA_ARGS__)                                                 \
+teardown(__VA_ARGS__);                                                        \
+}
+
+// Time op(data, thread) on 1, 2, 4, ... threads up to max_threads. See bench_threads.
+#define benchmark_threads(max_threads, op, data) \
+  bench_threads(#op, #data, max_threads, NULL, NULL, op, data)
+
+// As benchmark_threads, with setup(data, thread) and teardown(data, thread) run on every thread
+// before and after it is timed
+#define benchmark_threads_fixture(max_threads, setup, teardown, op, data) \
+  bench_threads(#op, #data, max_threads, setup, teardown, op, data)
+
+// Time fname(&params, ...) for every combination of parameters in the sweep. setup(&params, ...)
+// runs before and teardown(&params, ...) after the benchmark of each combination, outside of it.
+#define benchmark_sweep(sweep, setup, teardown, fname, ...)                   \
+{                                                                             \
+bench_params _m_params;                                                       \
+char _m_parameters[128];                                                      \
+for (size_t _m_k = 0; bench_sweep_next((sweep), _m_k, &_m_params); _m_k++) {  \
+  bench_params_format(&_m_params, _m_parameters, sizeof(_m_parameters));      \
+  setup(&_m_params, __VA_ARGS__);                                             \
+  bench_run(bench_keep, #fname, #__VA_ARGS__, _m_parameters, bench_nothing,  \
+            bench_nothing, fname, &_m_params, __VA_ARGS__)                    \
+  teardown(&_m_params, __VA_ARGS__);                                          \
 }                                                                             \
-print_centered(_m_testname, " BENCHMARKING ");                                \
-_m_runs = clamp(_m_runs, min_runs, max_runs);                                 \
-struct timespec *_m_measurements = malloc(sizeof(struct timespec) * _m_runs); \
-for (int i = 0; i < _m_runs; i++) {                                           \
-  clock_gettime(CLOCK_REALTIME, &_m_start);                                   \
-  (void)fname(__VA_ARGS__);                                                   \
-  clock_gettime(CLOCK_REALTIME, &_m_now);                                     \
-  timespecsub(&_m_now, &_m_start, &_m_measurements[i]);                       \
+}
+
+#define bench_run(keep, function, arguments, parameters, setup, teardown, fname, ...) \
+{                                                                             \
+bench_state _m_state;                                                         \
+bench_begin(&_m_state, function, arguments, parameters);                      \
+uint64_t _m_fixture, _m_start, _m_end;                                        \
+do {                                                                          \
+  _m_fixture = bench_ticks();                                                 \
+  setup(__VA_ARGS__);                                                         \
+  _m_start = bench_ticks();                                                   \
+  for (size_t _m_i = 0; _m_i < _m_state.window; _m_i++) {                     \
+    keep(fname(__VA_ARGS__));                                                 \
+  }                                                                           \
+  _m_end = bench_ticks();                                                     \
+  teardown(__VA_ARGS__);                                                      \
+} while (bench_window(&_m_state, _m_end - _m_start,                           \
+                      bench_ticks() - _m_fixture - (_m_end - _m_start)));     \
+bench_allocs_reset();                                                         \
+for (size_t _m_i = 0; _m_i < _m_state.runs; _m_i++) {                         \
+  setup(__VA_ARGS__);                                                         \
+  bench_counters_start(&_m_state.counters);                                   \
+  bench_allocs_start();                                                       \
+  _m_start = bench_ticks();                                                   \
+  for (size_t _m_j = 0; _m_j < _m_state.batch; _m_j++) {                      \
+    keep(fname(__VA_ARGS__));                                                 \
+  }                                                                           \
+  _m_state.samples[_m_i] = bench_ticks() - _m_start;                          \
+  bench_allocs_stop();                                                        \
+  bench_counters_stop(&_m_state.counters);                                    \
+  teardown(__VA_ARGS__);                                                      \
 }                                                                             \
-print_summary(_m_testname, _m_measurements, _m_runs);                         \
-free(_m_measurements);                                                        \
+_m_state.allocs = bench_allocs;                                               \
+print_summary(&_m_state);                                                     \
 }
 
 #endif
@@ -1,13 +1,250 @@
+#define BENCHMARK_ALLOCATIONS
 #include "benchmark.h"
+#include "../unittest/unittest.h"
+#include <fcntl.h>
 
 int my_func(size_t a, size_t b, size_t c){
   size_t result = 0;
-  for (size_t i = 0; i < a*b*c; i++)
+  for (size_t i = 0; i < a*b*c; i++) {
     result += i;
+    // otherwise the loop is folded into a closed form
+    bench_do_not_optimize(result);
+  }
   return result;
 }
 
+// A single multiplication, far below the cost of reading the clock
+size_t multiply(size_t *x) {
+  *x = *x * 6364136223846793005ull + 1442695040888963407ull;
+  return *x;
+}
+
+void reset(size_t *x) {
+  *x = 1;
+}
+
+void check(size_t *x) {
+  if (!*x)
+    puts("unexpected state");
+}
+
+// One block allocated and freed per call
+size_t allocate(size_t size) {
+  void *block = malloc(size);
+  bench_do_not_optimize(block);
+  free(block);
+  return size;
+}
+
+// Known values of the U test: no overlap, identical samples, and ties across the samples
+void test_mann_whitney(void) {
+  double low[] = { 1, 2, 3, 4, 5 }, high[] = { 6, 7, 8, 9, 10 }, tied[] = { 3, 3, 3, 3, 3 };
+  double a[] = { 1, 2, 2, 3, 3 }, b[] = { 3, 3, 4, 4, 5 };
+  double z = bench_mann_whitney(low, 5, high, 5);
+  ASSERT(z > -2.508 && z < -2.506);
+  z = bench_mann_whitney(high, 5, low, 5);
+  ASSERT(z > 2.506 && z < 2.508);
+  ASSERT_EQ(bench_mann_whitney(low, 5, low, 5), 0);
+  ASSERT_EQ(bench_mann_whitney(tied, 5, tied, 5), 0);
+  // ranks of a are 1, 2.5, 2.5, 5.5 and 5.5, so U = 2, and ties of 2, 4 and 2 values shrink the variance to 21.25
+  z = bench_mann_whitney(a, 5, b, 5);
+  ASSERT(z > -2.170 && z < -2.168);
+}
+
+// Records written by bench_record read back as the stored samples of the last record of their name
+void test_baseline(void) {
+  char path[] = "/tmp/test_benchmark_XXXXXX";
+  double expected[BENCHMARK_STORED_SAMPLES], read[BENCHMARK_STORED_SAMPLES];
+  uint64_t samples[3000];
+  // arguments with quotes and control characters, which escape to many times the size of the key
+  char arguments[4000];
+  for (size_t i = 0; i < sizeof(arguments) - 1; i++)
+    arguments[i] = "\"\n\\x"[i % 4];
+  arguments[sizeof(arguments) - 1] = 0;
+  bench_state s = { .function = "f", .arguments = arguments, .parameters = "", .batch = 4, .samples = samples };
+  int fd = mkstemp(path);
+  ASSERT(fd >= 0);
+  close(fd);
+  setenv("BENCHMARK_OUTPUT", path, 1);
+  bench_calibrate();
+  for (int i = 0; i < BENCH_COUNTERS; i++)
+    s.counters.count[i] = -1;
+
+  strcpy(s.key, "other(x)");
+  s.runs = 10;
+  for (size_t i = 0; i < s.runs; i++)
+    samples[i] = 1000000;
+  bench_record(&s, 0, 0);
+  snprintf(s.key, sizeof(s.key), "%s(%s)", s.function, s.arguments);
+  for (int pass = 0; pass < 2; pass++) {
+    // the second record has more samples than are stored
+    s.runs = pass ? 3000 : 20;
+    for (size_t i = 0; i < s.runs; i++)
+      samples[i] = (pass + 1) * 1000 * (i + 100);
+    bench_record(&s, 0, 0);
+  }
+  unsetenv("BENCHMARK_OUTPUT");
+
+  size_t n = bench_quantiles(&s, expected), m = bench_load_baseline(path, s.key, read);
+  ASSERT_EQ(n, (size_t)BENCHMARK_STORED_SAMPLES);
+  ASSERT_EQ(m, n);
+  for (size_t i = 0; i < n; i++)
+    ASSERT(read[i] > expected[i] - 0.001 && read[i] < expected[i] + 0.001);
+  ASSERT_EQ(bench_load_baseline(path, "other(x)", read), 10);
+  ASSERT_EQ(bench_load_baseline(path, "f(x)", read), 0);
+  ASSERT_EQ(bench_load_baseline("/nonexistent/baseline.json", s.key, read), 0);
+  remove(path);
+}
+
+#define ASSERT_CLOSE(X, Y, TOLERANCE) ASSERT((X) - (Y) <= (TOLERANCE) && (Y) - (X) <= (TOLERANCE))
+
+// The math which stands in for libm, against values from libm, to a relative error of 1e-12
+void test_math(void) {
+  double logs[][2] = {
+    { 1, 0 }, { 2, 0.6931471805599453 }, { 2.718281828459045, 1 }, { 10, 2.302585092994046 },
+    { 0.7, -0.35667494393873245 }, { 1e-5, -11.512925464970229 }, { 1e300, 690.7755278982137 },
+  };
+  double exps[][2] = {
+    { 0, 1 }, { 1, 2.718281828459045 }, { -1, 0.36787944117144233 }, { 0.5, 1.6487212707001282 },
+    { 10, 22026.465794806718 }, { -20, 2.061153622438558e-09 }, { 700, 1.0142320547350045e+304 },
+  };
+  for (size_t i = 0; i < sizeof(logs) / sizeof(logs[0]); i++)
+    ASSERT_CLOSE(bench_log(logs[i][0]), logs[i][1], 1e-12 * (logs[i][1] < 0 ? -logs[i][1] : logs[i][1]) + 1e-15);
+  for (size_t i = 0; i < sizeof(exps) / sizeof(exps[0]); i++)
+    ASSERT_CLOSE(bench_exp(exps[i][0]), exps[i][1], 1e-12 * exps[i][1]);
+  ASSERT_CLOSE(bench_pow(2, 10), 1024, 1e-9);
+  ASSERT_CLOSE(bench_pow(10, -3), 1e-3, 1e-15);
+  ASSERT_CLOSE(bench_pow(2, -0.99), 0.5034777750283594, 1e-12);
+}
+
+// Every combination of a sweep, with the last list varying fastest and empty lists at their defaults
+void test_sweep(void) {
+  bench_sweep sweep = {
+    .sizes = bench_values(10, 100),
+    .distributions = bench_values(BENCH_UNIFORM, BENCH_ZIPFIAN),
+    .reads = bench_values(1, 0.5),
+  };
+  bench_params p;
+  char label[128];
+  size_t k = 0;
+  for (; bench_sweep_next(&sweep, k, &p); k++) {
+    ASSERT_EQ(p.size, k < 4 ? 10 : 100);
+    ASSERT_EQ(p.load, 0);
+    ASSERT_EQ(p.distribution, k / 2 % 2 ? BENCH_ZIPFIAN : BENCH_UNIFORM);
+    ASSERT_EQ(p.reads, k % 2 ? 0.5 : 1);
+  }
+  ASSERT_EQ(k, 8);
+  bench_sweep_next(&sweep, 7, &p);
+  bench_params_format(&p, label, sizeof(label));
+  ASSERT_STREQ(label, "[size=100 keys=zipfian reads=0.50]");
+
+  bench_sweep empty = {0};
+  ASSERT(bench_sweep_next(&empty, 0, &p));
+  ASSERT(!bench_sweep_next(&empty, 1, &p));
+  ASSERT(p.size == 1000 && p.load == 0 && p.distribution == BENCH_UNIFORM && p.reads == 1);
+
+  bench_list sizes = bench_geometric(1e3, 1e5, 10);
+  ASSERT_EQ(sizes.n, 3);
+  ASSERT(sizes.values[0] == 1e3 && sizes.values[1] == 1e4 && sizes.values[2] == 1e5);
+}
+
+// Rank frequencies of the Zipfian keys, against i^-theta normalized. The first two ranks are drawn
+// exactly; the rest come from an approximation which is within a percentage point for small n.
+void test_zipf(void) {
+  size_t sizes[] = { 1, 2, 3, 4, 10 }, draws = 1000000;
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    size_t n = sizes[s], count[10] = {0};
+    uint64_t state = 42;
+    double total = 0;
+    bench_zipf z;
+    mk_bench_zipf(&z, n, BENCHMARK_ZIPF_THETA);
+    ASSERT(z.eta == z.eta);
+    for (size_t i = 0; i < draws; i++) {
+      size_t rank = bench_zipf_next(&z, &state);
+      ASSERT(rank < n);
+      count[rank]++;
+    }
+    for (size_t i = 1; i <= n; i++)
+      total += bench_pow(i, -BENCHMARK_ZIPF_THETA);
+    for (size_t i = 0; i < n; i++) {
+      double expected = bench_pow(i + 1, -BENCHMARK_ZIPF_THETA) / total;
+      ASSERT_CLOSE((double)count[i] / draws, expected, i < 2 ? 0.003 : 0.01);
+    }
+  }
+}
+
+// Calls of each thread, a cache line apart
+typedef struct {
+  size_t calls[4][8];
+} counts;
+
+void count_call(void *data, int thread) {
+  ((counts*)data)->calls[thread][0]++;
+}
+
+void allocate_call(void *data, int thread) {
+  (void)data;
+  (void)thread;
+  void *p = malloc(16);
+  bench_do_not_optimize(p);
+  free(p);
+}
+
+// Lowest free descriptor, which moves up if a benchmark leaks one
+int lowest_free_fd(void) {
+  int fd = open("/dev/null", O_RDONLY);
+  close(fd);
+  return fd;
+}
+
+// Every thread calls the function, and the benchmark closes the counters it opened and counts the allocations
+void test_threads(void) {
+  counts c = {0};
+  int fd = lowest_free_fd();
+  benchmark_threads(4, count_call, &c);
+  for (int i = 0; i < 4; i++)
+    ASSERT(c.calls[i][0] > 0);
+  ASSERT_EQ(lowest_free_fd(), fd);
+  // the allocations of the threads are counted, here those of the last thread count
+  benchmark_threads(2, allocate_call, NULL);
+  ASSERT(bench_allocs.allocations > 0);
+  ASSERT_EQ(bench_allocs.frees, bench_allocs.allocations);
+  ASSERT_EQ(bench_allocs.bytes, 16 * bench_allocs.allocations);
+}
+
+// Every allocator is counted, so the frees balance the allocations
+void test_allocations(void) {
+  void *aligned = NULL;
+  bench_allocs_reset();
+  bench_allocs_start();
+  char *a = malloc(10), *b = calloc(4, 5);
+  bench_do_not_optimize(b);
+  a = realloc(a, 100);
+  bench_do_not_optimize(a);
+  ASSERT_EQ(posix_memalign(&aligned, 64, 30), 0);
+  ASSERT_EQ(posix_memalign(&aligned, 3, 30), EINVAL);
+  ASSERT_EQ((uintptr_t)aligned % 64, 0);
+  free(a);
+  free(b);
+  free(aligned);
+  bench_allocs_stop();
+  ASSERT_EQ(bench_allocs.allocations, 4);
+  ASSERT_EQ(bench_allocs.frees, 4);
+  ASSERT_EQ(bench_allocs.bytes, 10 + 20 + 100 + 30);
+}
+
 int main(void) {
+  size_t x;
+  test_mann_whitney();
+  test_baseline();
+  test_math();
+  test_sweep();
+  test_zipf();
+  test_allocations();
   benchmark(my_func, 10, 20, 30);
   benchmark(my_func, 100, 200, 300);
+  benchmark_fixture(reset, check, multiply, &x);
+  benchmark(allocate, 1000);
+  test_threads();
+  return bench_regressions != 0;
 }
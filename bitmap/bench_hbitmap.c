@@ -0,0 +1,31 @@
+#define HBITMAP_IMPLEMENTATION
+#include "hbitmap.h"
+#include "../benchmark/benchmark.h"
+
+// Allocate the only free slot of an almost full table and free it again
+size_t alloc_hierarchical(hbitmap_t *h) {
+  size_t idx = hbitmap_alloc(h);
+  hbitmap_set_bit(h, idx, 0);
+  return idx;
+}
+
+size_t alloc_flat(bitmap_t *bitmap, size_t size) {
+  size_t idx = bitmap_find_next_zero(bitmap, size, 0);
+  set_bit(bitmap, idx, 1);
+  set_bit(bitmap, idx, 0);
+  return idx;
+}
+
+int main(void) {
+  size_t size = 1e9;
+  hbitmap_t h;
+  mk_hbitmap(&h, size);
+  bitmap_set_range(h.bits, 0, size);
+  bitmap_clear_range(h.bits, size - 1000, size - 999);
+  hbitmap_rebuild(&h);
+
+  benchmark(alloc_hierarchical, &h);
+  benchmark(alloc_flat, h.bits, size);
+  destroy_hbitmap(&h);
+  return 0;
+}
@@ -3,64 +3,668 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
-typedef unsigned char bitmap_t;
+// Bits are stored in 64-bit words. Bit idx lives in word idx / 64, at position idx % 64.
+typedef uint64_t bitmap_t;
 typedef unsigned char bit_t;
 
+#define BITMAP_WORD_BITS (8 * sizeof(bitmap_t))
+// Number of words needed to store the given number of bits
+#define BITMAP_WORDS(bits) ((bits) / BITMAP_WORD_BITS + 1)
+
 // Make a new bitmap with the given capacity
 bitmap_t *mk_bitmap(size_t capacity);
 // Destroy the given bitmap
 void destroy_bitmap(bitmap_t *bitmap);
+// Make a new bitmap with the given capacity in reserved address space. Pages are only committed
+// when they are first written, so a huge sparse bitmap costs only the pages it touches.
+// Returns NULL if the address space could not be reserved.
+bitmap_t *mk_bitmap_virtual(size_t capacity);
+// Map a bitmap with the given capacity from a file, creating or growing the file as needed.
+// Changes are written back to the file and are visible to other processes mapping the same file.
+// Returns NULL if the file could not be opened or mapped.
+bitmap_t *mk_bitmap_file(const char *path, size_t capacity);
+// Write the changes to a file backed bitmap back to its file
+int bitmap_sync(bitmap_t *bitmap, size_t capacity);
+// Destroy a bitmap made with mk_bitmap_virtual or mk_bitmap_file
+void destroy_bitmap_mapped(bitmap_t *bitmap, size_t capacity);
 // Return true if the given bit is set in the bitmap.
-bool bit_set(const bitmap_t *bitmap, size_t idx);
+static inline bool bit_set(const bitmap_t *bitmap, size_t idx);
 // Turn the given bit on or off
-void set_bit(bitmap_t *bitmap, size_t idx, bit_t value);
+static inline void set_bit(bitmap_t *bitmap, size_t idx, bit_t value);
 // Toggle the given bit
-void toggle_bit(bitmap_t *bitmap, size_t idx);
+static inline void toggle_bit(bitmap_t *bitmap, size_t idx);
+// Count the set bits among the first bitmap_size bits of the bitmap
+size_t bitmap_sum(const bitmap_t *bitmap, size_t bitmap_size);
+// Count the set bits in n words. Dispatches to the fastest implementation supported by the cpu.
+size_t bitmap_popcount(const bitmap_t *words, size_t n);
+// Turn on the bits in [start, end)
+void bitmap_set_range(bitmap_t *bitmap, size_t start, size_t end);
+// Turn off the bits in [start, end)
+void bitmap_clear_range(bitmap_t *bitmap, size_t start, size_t end);
+// Toggle the bits in [start, end)
+void bitmap_toggle_range(bitmap_t *bitmap, size_t start, size_t end);
+// Set algebra over bitmaps of equal size. out may be a or b to update a bitmap in place.
+// Bits past bitmap_size in the last word of out are unspecified.
+void bitmap_and(bitmap_t *out, const bitmap_t *a, const bitmap_t *b, size_t bitmap_size);
+void bitmap_or(bitmap_t *out, const bitmap_t *a, const bitmap_t *b, size_t bitmap_size);
+void bitmap_xor(bitmap_t *out, const bitmap_t *a, const bitmap_t *b, size_t bitmap_size);
+// a and not b
+void bitmap_andnot(bitmap_t *out, const bitmap_t *a, const bitmap_t *b, size_t bitmap_size);
+void bitmap_not(bitmap_t *out, const bitmap_t *a, size_t bitmap_size);
+// Count the set bits of the result of a set operation without writing it
+size_t bitmap_and_count(const bitmap_t *a, const bitmap_t *b, size_t bitmap_size);
+size_t bitmap_or_count(const bitmap_t *a, const bitmap_t *b, size_t bitmap_size);
+size_t bitmap_xor_count(const bitmap_t *a, const bitmap_t *b, size_t bitmap_size);
+size_t bitmap_andnot_count(const bitmap_t *a, const bitmap_t *b, size_t bitmap_size);
+
+// Auxiliary rank/select index over a bitmap. It stores the number of set bits before every
+// superblock of 4096 bits and every block of 512 bits, about 4.7% of the size of the bitmap.
+// The index is not updated when the bitmap changes; call bitmap_rank_rebuild after updates.
+typedef struct {
+  const bitmap_t *bitmap;
+  size_t size;       // Number of bits in the bitmap
+  size_t ones;       // Number of set bits in the bitmap
+  uint64_t *supers;  // Set bits before each superblock
+  uint16_t *blocks;  // Set bits before each block, relative to its superblock
+  size_t *samples;   // Superblock holding every BITMAP_SELECT_SAMPLE-th set bit
+} bitmap_rank_t;
+
+// Build a rank/select index over the first bitmap_size bits of bitmap
+void mk_bitmap_rank(bitmap_rank_t *r, const bitmap_t *bitmap, size_t bitmap_size);
+// Recompute the index after the bitmap has been modified
+void bitmap_rank_rebuild(bitmap_rank_t *r);
+// Free the index. The bitmap itself is not freed.
+void destroy_bitmap_rank(bitmap_rank_t *r);
+// Number of set bits before idx, where idx <= bitmap_size
+size_t bitmap_rank(const bitmap_rank_t *r, size_t idx);
+// Position of the set bit with rank k (counting from 0), or bitmap_size if fewer than k + 1 bits are set
+size_t bitmap_select(const bitmap_rank_t *r, size_t k);
+
+// Atomic operations, for bitmaps shared between threads. Never mix them with the non-atomic
+// single bit operations on a bitmap that other threads are modifying.
+// Return true if the given bit is set
+static inline bool atomic_bit_set(const bitmap_t *bitmap, size_t idx);
+// Set the given bit, returning true if it was already set
+static inline bool bitmap_test_and_set(bitmap_t *bitmap, size_t idx);
+// Clear the given bit, returning true if it was set
+static inline bool bitmap_test_and_clear(bitmap_t *bitmap, size_t idx);
+// Toggle the given bit, returning true if it was set
+static inline bool bitmap_test_and_toggle(bitmap_t *bitmap, size_t idx);
+// Or mask into the word with the given index, returning the previous value of the word
+static inline bitmap_t bitmap_fetch_or(bitmap_t *bitmap, size_t word, bitmap_t mask);
+// And mask into the word with the given index, returning the previous value of the word
+static inline bitmap_t bitmap_fetch_and(bitmap_t *bitmap, size_t word, bitmap_t mask);
+// bitmap_sum split across `threads` threads (0: one per online cpu)
+size_t bitmap_sum_parallel(const bitmap_t *bitmap, size_t bitmap_size, int threads);
+// Return the index of the first set bit, or bitmap_size if no bit is set
+size_t bitmap_find_first_set(const bitmap_t *bitmap, size_t bitmap_size);
+// Return the index of the first set bit at or after idx, or bitmap_size if there is none
+size_t bitmap_find_next_set(const bitmap_t *bitmap, size_t bitmap_size, size_t idx);
+// Return the index of the first unset bit at or after idx, or bitmap_size if there is none
+size_t bitmap_find_next_zero(const bitmap_t *bitmap, size_t bitmap_size, size_t idx);
+
+static inline bool bit_set(const bitmap_t *bitmap, size_t idx) {
+  return (bitmap[idx / BITMAP_WORD_BITS] >> (idx % BITMAP_WORD_BITS)) & 1;
+}
+
+static inline void set_bit(bitmap_t *bitmap, size_t idx, bit_t value) {
+  size_t index, bit;
+  index = idx / BITMAP_WORD_BITS;
+  bit = idx % BITMAP_WORD_BITS;
+  if (value) {
+    bitmap[index] |= ((bitmap_t)1 << bit);
+  } else {
+    bitmap[index] &= ~((bitmap_t)1 << bit);
+  }
+}
+
+static inline void toggle_bit(bitmap_t *bitmap, size_t idx) {
+  size_t index, bit;
+  index = idx / BITMAP_WORD_BITS;
+  bit = idx % BITMAP_WORD_BITS;
+  bitmap[index] ^= (bitmap_t)1 << bit;
+}
+
+static inline bool atomic_bit_set(const bitmap_t *bitmap, size_t idx) {
+  return (__atomic_load_n(&bitmap[idx / BITMAP_WORD_BITS], __ATOMIC_ACQUIRE) >> (idx % BITMAP_WORD_BITS)) & 1;
+}
+
+static inline bitmap_t bitmap_fetch_or(bitmap_t *bitmap, size_t word, bitmap_t mask) {
+  return __atomic_fetch_or(&bitmap[word], mask, __ATOMIC_ACQ_REL);
+}
+
+static inline bitmap_t bitmap_fetch_and(bitmap_t *bitmap, size_t word, bitmap_t mask) {
+  return __atomic_fetch_and(&bitmap[word], mask, __ATOMIC_ACQ_REL);
+}
+
+static inline bool bitmap_test_and_set(bitmap_t *bitmap, size_t idx) {
+  bitmap_t bit = (bitmap_t)1 << (idx % BITMAP_WORD_BITS);
+  bitmap_t *word = &bitmap[idx / BITMAP_WORD_BITS];
+  // Checking first avoids taking the cache line exclusively when the bit is already set,
+  // which is the common case in visited sets once a traversal is under way
+  if (__atomic_load_n(word, __ATOMIC_ACQUIRE) & bit)
+    return true;
+  return __atomic_fetch_or(word, bit, __ATOMIC_ACQ_REL) & bit;
+}
+
+static inline bool bitmap_test_and_clear(bitmap_t *bitmap, size_t idx) {
+  bitmap_t bit = (bitmap_t)1 << (idx % BITMAP_WORD_BITS);
+  return __atomic_fetch_and(&bitmap[idx / BITMAP_WORD_BITS], ~bit, __ATOMIC_ACQ_REL) & bit;
+}
+
+static inline bool bitmap_test_and_toggle(bitmap_t *bitmap, size_t idx) {
+  bitmap_t bit = (bitmap_t)1 << (idx % BITMAP_WORD_BITS);
+  return __atomic_fetch_xor(&bitmap[idx / BITMAP_WORD_BITS], bit, __ATOMIC_ACQ_REL) & bit;
+}
 
 #endif // __BITMAP_H
 
-#ifdef BITMAP_IMPLEMENTATION
+// roaring.h and hbitmap.h include the implementation too, so it is only compiled the first time
+#if defined(BITMAP_IMPLEMENTATION) && !defined(__BITMAP_IMPLEMENTED)
+#define __BITMAP_IMPLEMENTED
 #undef BITMAP_IMPLEMENTATION
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define BITMAP_X86
+#include <immintrin.h>
+#endif
 
 bitmap_t *mk_bitmap(size_t capacity) {
-  return calloc(capacity / (8 * sizeof(bitmap_t)) + 1, sizeof(bitmap_t));
+  return calloc(BITMAP_WORDS(capacity), sizeof(bitmap_t));
 }
 
 void destroy_bitmap(bitmap_t *bitmap) {
   free(bitmap);
 }
 
-size_t bitmap_sum(bitmap_t *bitmap, size_t bitmap_size) {
+#define mapped_bytes(capacity) (BITMAP_WORDS(capacity) * sizeof(bitmap_t))
+
+bitmap_t *mk_bitmap_virtual(size_t capacity) {
+  // Anonymous pages are zero and are only committed once written. arena_alloc is not used here
+  // because it touches every page it hands out, while bits are set at random offsets.
+  bitmap_t *bitmap = mmap(0, mapped_bytes(capacity), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  return bitmap == MAP_FAILED ? NULL : bitmap;
+}
+
+bitmap_t *mk_bitmap_file(const char *path, size_t capacity) {
+  struct stat st;
+  bitmap_t *bitmap;
+  int fd = open(path, O_RDWR|O_CREAT, 0644);
+  if (fd < 0)
+    return NULL;
+  // Growing the file leaves a hole which reads as zeros and takes no disk space until written
+  if (fstat(fd, &st) || ((size_t)st.st_size < mapped_bytes(capacity) && ftruncate(fd, mapped_bytes(capacity)))) {
+    close(fd);
+    return NULL;
+  }
+  bitmap = mmap(0, mapped_bytes(capacity), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  // the mapping keeps the file open
+  close(fd);
+  return bitmap == MAP_FAILED ? NULL : bitmap;
+}
+
+int bitmap_sync(bitmap_t *bitmap, size_t capacity) {
+  return msync(bitmap, mapped_bytes(capacity), MS_SYNC);
+}
+
+void destroy_bitmap_mapped(bitmap_t *bitmap, size_t capacity) {
+  if (munmap(bitmap, mapped_bytes(capacity))) {
+    perror("munmap:");
+    exit(1);
+  }
+}
+
+// Portable popcount, used when the cpu has no popcnt instruction
+static inline size_t popcount_word(bitmap_t w) {
+  w = w - ((w >> 1) & 0x5555555555555555ull);
+  w = (w & 0x3333333333333333ull) + ((w >> 2) & 0x3333333333333333ull);
+  w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0full;
+  return (w * 0x0101010101010101ull) >> 56;
+}
+
+size_t bitmap_popcount_portable(const bitmap_t *words, size_t n) {
   size_t sum = 0;
-  for (size_t i = 0; i < bitmap_size; i++)
-    sum += bit_set(bitmap, i) ? 1 : 0;
+  for (size_t i = 0; i < n; i++)
+    sum += popcount_word(words[i]);
   return sum;
 }
 
-inline bool bit_set(const bitmap_t *bitmap, size_t idx) {
-  return (bitmap[idx/8] >> (idx % 8)) & 1;
+#ifdef BITMAP_X86
+__attribute__((target("popcnt")))
+size_t bitmap_popcount_popcnt(const bitmap_t *words, size_t n) {
+  size_t sum = 0;
+  for (size_t i = 0; i < n; i++)
+    sum += __builtin_popcountll(words[i]);
+  return sum;
 }
 
-void set_bit(bitmap_t *bitmap, size_t idx, bit_t value) {
-  size_t index, bit;
-  index = idx / (sizeof(bitmap_t) * 8);
-  bit = idx % (sizeof(bitmap_t) * 8);
-  if (value) {
-    bitmap[index] |= (1l << bit);
-  } else {
-    bitmap[index] &= ~0l ^ (1l << bit);
+// Count the bits of each byte with a nibble lookup table (vpshufb), then sum the bytes of each 64-bit lane (vpsadbw)
+__attribute__((target("avx2")))
+static inline __m256i popcount_lanes_avx2(__m256i v) {
+  const __m256i lookup = _mm256_setr_epi8(
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+  __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low_mask));
+  __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask));
+  return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static inline size_t sum_lanes_avx2(__m256i acc) {
+  return _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1)
+       + _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+}
+
+__attribute__((target("avx2")))
+size_t bitmap_popcount_avx2(const bitmap_t *words, size_t n) {
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0, sum = 0;
+  for (; i + 4 <= n; i += 4)
+    acc = _mm256_add_epi64(acc, popcount_lanes_avx2(_mm256_loadu_si256((const __m256i*)(words + i))));
+  sum = sum_lanes_avx2(acc);
+  for (; i < n; i++)
+    sum += popcount_word(words[i]);
+  return sum;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+size_t bitmap_popcount_avx512(const bitmap_t *words, size_t n) {
+  const __m512i lookup = _mm512_set4_epi32(0x04030302, 0x03020201, 0x03020201, 0x02010100);
+  const __m512i low_mask = _mm512_set1_epi8(0x0f);
+  __m512i acc = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i v = _mm512_loadu_si512((const void*)(words + i));
+    __m512i lo = _mm512_shuffle_epi8(lookup, _mm512_and_si512(v, low_mask));
+    __m512i hi = _mm512_shuffle_epi8(lookup, _mm512_and_si512(_mm512_srli_epi16(v, 4), low_mask));
+    acc = _mm512_add_epi64(acc, _mm512_sad_epu8(_mm512_add_epi8(lo, hi), _mm512_setzero_si512()));
   }
+  size_t sum = _mm512_reduce_add_epi64(acc);
+  for (; i < n; i++)
+    sum += popcount_word(words[i]);
+  return sum;
 }
+#endif // BITMAP_X86
 
-void toggle_bit(bitmap_t *bitmap, size_t idx) {
-  size_t index, bit;
-  index = idx / (sizeof(bitmap_t) * 8);
-  bit = idx % (sizeof(bitmap_t) * 8);
-  bitmap[index] ^= 1l << bit;
+static size_t (*__bitmap_popcount)(const bitmap_t *words, size_t n) = NULL;
+
+size_t bitmap_popcount(const bitmap_t *words, size_t n) {
+  if (!__bitmap_popcount) {
+    __bitmap_popcount = bitmap_popcount_portable;
+#ifdef BITMAP_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw"))
+      __bitmap_popcount = bitmap_popcount_avx512;
+    else if (__builtin_cpu_supports("avx2"))
+      __bitmap_popcount = bitmap_popcount_avx2;
+    else if (__builtin_cpu_supports("popcnt"))
+      __bitmap_popcount = bitmap_popcount_popcnt;
+#endif
+  }
+  return __bitmap_popcount(words, n);
+}
+
+size_t bitmap_sum(const bitmap_t *bitmap, size_t bitmap_size) {
+  size_t full = bitmap_size / BITMAP_WORD_BITS;
+  size_t rest = bitmap_size % BITMAP_WORD_BITS;
+  size_t sum = bitmap_popcount(bitmap, full);
+  // Bits past bitmap_size in the last word are not counted
+  if (rest)
+    sum += popcount_word(bitmap[full] & (((bitmap_t)1 << rest) - 1));
+  return sum;
+}
+
+typedef struct {
+  const bitmap_t *words;
+  size_t n;
+  size_t sum;
+} sum_task;
+
+void *sum_words(void *arg) {
+  sum_task *task = arg;
+  task->sum = bitmap_popcount(task->words, task->n);
+  return NULL;
+}
+
+size_t bitmap_sum_parallel(const bitmap_t *bitmap, size_t bitmap_size, int threads) {
+  size_t full = bitmap_size / BITMAP_WORD_BITS, sum = 0;
+  if (threads <= 0)
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  // not worth starting a thread for less than a few pages of words
+  if ((size_t)threads > full / 4096)
+    threads = full / 4096;
+  if (threads <= 1)
+    return bitmap_sum(bitmap, bitmap_size);
+
+  bitmap_popcount(bitmap, 0); // pick the implementation before the threads race to do it
+  sum_task tasks[threads];
+  pthread_t handles[threads];
+  bool started[threads];
+  for (int t = 0; t < threads; t++) {
+    size_t start = full * t / threads, end = full * (t + 1) / threads;
+    tasks[t] = (sum_task) { .words = bitmap + start, .n = end - start };
+    started[t] = t > 0 && pthread_create(&handles[t], NULL, sum_words, &tasks[t]) == 0;
+  }
+  for (int t = 0; t < threads; t++) {
+    if (started[t])
+      pthread_join(handles[t], NULL);
+    else
+      sum_words(&tasks[t]);
+    sum += tasks[t].sum;
+  }
+  // the trailing partial word
+  return sum + bitmap_sum(bitmap + full, bitmap_size % BITMAP_WORD_BITS);
+}
+
+// Mask of the bits in [start, end) of a single word, where 0 <= start < end <= 64
+#define word_mask(start, end) \
+  ((~(bitmap_t)0 >> (BITMAP_WORD_BITS - ((end) - (start)))) << (start))
+
+// Apply op to the bits in [start, end). Whole words in the middle are handled by `middle`.
+#define range_op(bitmap, start, end, op, middle)                                      \
+do {                                                                                  \
+  if ((start) >= (end)) break;                                                        \
+  size_t _first = (start) / BITMAP_WORD_BITS, _last = ((end) - 1) / BITMAP_WORD_BITS; \
+  size_t _lo = (start) % BITMAP_WORD_BITS, _hi = ((end) - 1) % BITMAP_WORD_BITS + 1;  \
+  if (_first == _last) {                                                              \
+    op(bitmap[_first], word_mask(_lo, _hi));                                          \
+    break;                                                                            \
+  }                                                                                   \
+  op(bitmap[_first], word_mask(_lo, BITMAP_WORD_BITS));                               \
+  middle(bitmap + _first + 1, _last - _first - 1);                                    \
+  op(bitmap[_last], word_mask(0, _hi));                                               \
+} while (0)
+
+#define or_op(word, mask) ((word) |= (mask))
+#define andnot_op(word, mask) ((word) &= ~(mask))
+#define xor_op(word, mask) ((word) ^= (mask))
+#define set_words(words, n) memset((words), 0xff, (n) * sizeof(bitmap_t))
+#define clear_words(words, n) memset((words), 0, (n) * sizeof(bitmap_t))
+#define toggle_words(words, n) for (size_t _i = 0; _i < (n); _i++) (words)[_i] = ~(words)[_i]
+
+void bitmap_set_range(bitmap_t *bitmap, size_t start, size_t end) {
+  range_op(bitmap, start, end, or_op, set_words);
+}
+
+void bitmap_clear_range(bitmap_t *bitmap, size_t start, size_t end) {
+  range_op(bitmap, start, end, andnot_op, clear_words);
+}
+
+void bitmap_toggle_range(bitmap_t *bitmap, size_t start, size_t end) {
+  range_op(bitmap, start, end, xor_op, toggle_words);
+}
+
+// Return the index of the first word in [from, n) which differs from pattern, or n if they are all equal.
+// pattern is either all zeros (skip empty words) or all ones (skip full words).
+size_t skip_words_portable(const bitmap_t *words, size_t from, size_t n, bitmap_t pattern) {
+  for (; from < n && words[from] == pattern; from++);
+  return from;
+}
+
+#ifdef BITMAP_X86
+// Compare four words at a time, so long runs of empty or full words are skipped at memory bandwidth
+__attribute__((target("avx2")))
+size_t skip_words_avx2(const bitmap_t *words, size_t from, size_t n, bitmap_t pattern) {
+  const __m256i p = _mm256_set1_epi64x(pattern);
+  for (; from + 4 <= n; from += 4) {
+    __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(words + from)), p);
+    if (!_mm256_testz_si256(v, v))
+      break;
+  }
+  return skip_words_portable(words, from, n, pattern);
+}
+#endif // BITMAP_X86
+
+static size_t (*__skip_words)(const bitmap_t *words, size_t from, size_t n, bitmap_t pattern) = NULL;
+
+static inline size_t skip_words(const bitmap_t *words, size_t from, size_t n, bitmap_t pattern) {
+  if (!__skip_words) {
+    __skip_words = skip_words_portable;
+#ifdef BITMAP_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      __skip_words = skip_words_avx2;
+#endif
+  }
+  return __skip_words(words, from, n, pattern);
+}
+
+// Find the first bit at or after idx whose value differs from the bits in pattern
+static inline size_t find_next(const bitmap_t *bitmap, size_t bitmap_size, size_t idx, bitmap_t pattern) {
+  size_t words, index;
+  bitmap_t w;
+  if (idx >= bitmap_size)
+    return bitmap_size;
+  words = (bitmap_size + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+  index = idx / BITMAP_WORD_BITS;
+  // ignore the bits before idx in the first word
+  w = (bitmap[index] ^ pattern) & (~(bitmap_t)0 << (idx % BITMAP_WORD_BITS));
+  if (!w) {
+    index = skip_words(bitmap, index + 1, words, pattern);
+    if (index == words)
+      return bitmap_size;
+    w = bitmap[index] ^ pattern;
+  }
+  idx = index * BITMAP_WORD_BITS + __builtin_ctzll(w);
+  return idx < bitmap_size ? idx : bitmap_size;
+}
+
+size_t bitmap_find_first_set(const bitmap_t *bitmap, size_t bitmap_size) {
+  return find_next(bitmap, bitmap_size, 0, 0);
+}
+
+size_t bitmap_find_next_set(const bitmap_t *bitmap, size_t bitmap_size, size_t idx) {
+  return find_next(bitmap, bitmap_size, idx, 0);
+}
+
+size_t bitmap_find_next_zero(const bitmap_t *bitmap, size_t bitmap_size, size_t idx) {
+  return find_next(bitmap, bitmap_size, idx, ~(bitmap_t)0);
+}
+
+#define and_word(a, b) ((a) & (b))
+#define or_word(a, b) ((a) | (b))
+#define xor_word(a, b) ((a) ^ (b))
+#define andnot_word(a, b) ((a) & ~(b))
+#define and_vec(a, b) _mm256_and_si256(a, b)
+#define or_vec(a, b) _mm256_or_si256(a, b)
+#define xor_vec(a, b) _mm256_xor_si256(a, b)
+#define andnot_vec(a, b) _mm256_andnot_si256(b, a)
+
+#ifdef BITMAP_X86
+// Four words at a time. Counting variants popcount each result vector instead of storing it.
+#define set_op_avx2(op)                                                                       \
+__attribute__((target("avx2")))                                                               \
+void op##_words_avx2(bitmap_t *out, const bitmap_t *a, const bitmap_t *b, size_t n) {          \
+  size_t i = 0;                                                                               \
+  for (; i + 4 <= n; i += 4) {                                                                \
+    __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));                                 \
+    __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));                                 \
+    _mm256_storeu_si256((__m256i*)(out + i), op##_vec(va, vb));                               \
+  }                                                                                           \
+  for (; i < n; i++)                                                                          \
+    out[i] = op##_word(a[i], b[i]);                                                           \
+}                                                                                             \
+__attribute__((target("avx2")))                                                               \
+size_t op##_count_avx2(const bitmap_t *a, const bitmap_t *b, size_t n) {                      \
+  __m256i acc = _mm256_setzero_si256();                                                       \
+  size_t i = 0, sum;                                                                          \
+  for (; i + 4 <= n; i += 4) {                                                                \
+    __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));                                 \
+    __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));                                 \
+    acc = _mm256_add_epi64(acc, popcount_lanes_avx2(op##_vec(va, vb)));                       \
+  }                                                                                           \
+  sum = sum_lanes_avx2(acc);                                                                  \
+  for (; i < n; i++)                                                                          \
+    sum += popcount_word(op##_word(a[i], b[i]));                                              \
+  return sum;                                                                                 \
+}
+#define select_avx2(ptr, op, suffix)                                                          \
+  __builtin_cpu_init();                                                                       \
+  if (__builtin_cpu_supports("avx2"))                                                         \
+    ptr = op##_##suffix##_avx2;
+#else
+#define set_op_avx2(op)
+#define select_avx2(ptr, op, suffix)
+#endif // BITMAP_X86
+
+// Define bitmap_<op> and bitmap_<op>_count, dispatching to the fastest implementation supported by the cpu
+#define set_op(op)                                                                            \
+void op##_words_portable(bitmap_t *out, const bitmap_t *a, const bitmap_t *b, size_t n) {      \
+  for (size_t i = 0; i < n; i++)                                                              \
+    out[i] = op##_word(a[i], b[i]);                                                           \
+}                                                                                             \
+size_t op##_count_portable(const bitmap_t *a, const bitmap_t *b, size_t n) {                  \
+  size_t sum = 0;                                                                             \
+  for (size_t i = 0; i < n; i++)                                                              \
+    sum += popcount_word(op##_word(a[i], b[i]));                                              \
+  return sum;                                                                                 \
+}                                                                                             \
+set_op_avx2(op)                                                                               \
+static void (*__##op##_words)(bitmap_t *out, const bitmap_t *a, const bitmap_t *b, size_t n);  \
+static size_t (*__##op##_count)(const bitmap_t *a, const bitmap_t *b, size_t n);              \
+void bitmap_##op(bitmap_t *out, const bitmap_t *a, const bitmap_t *b, size_t bitmap_size) {    \
+  if (!__##op##_words) {                                                                      \
+    __##op##_words = op##_words_portable;                                                     \
+    select_avx2(__##op##_words, op, words)                                                    \
+  }                                                                                           \
+  __##op##_words(out, a, b, (bitmap_size + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS);         \
+}                                                                                             \
+size_t bitmap_##op##_count(const bitmap_t *a, const bitmap_t *b, size_t bitmap_size) {        \
+  size_t full = bitmap_size / BITMAP_WORD_BITS;                                               \
+  size_t rest = bitmap_size % BITMAP_WORD_BITS;                                               \
+  size_t sum;                                                                                 \
+  if (!__##op##_count) {                                                                      \
+    __##op##_count = op##_count_portable;                                                     \
+    select_avx2(__##op##_count, op, count)                                                    \
+  }                                                                                           \
+  sum = __##op##_count(a, b, full);                                                           \
+  if (rest)                                                                                   \
+    sum += popcount_word(op##_word(a[full], b[full]) & (((bitmap_t)1 << rest) - 1));          \
+  return sum;                                                                                 \
+}
+
+set_op(and)
+set_op(or)
+set_op(xor)
+set_op(andnot)
+
+void bitmap_not(bitmap_t *out, const bitmap_t *a, size_t bitmap_size) {
+  size_t n = (bitmap_size + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+  for (size_t i = 0; i < n; i++)
+    out[i] = ~a[i];
+}
+
+#define RANK_BLOCK_WORDS 8
+#define RANK_SUPER_WORDS 64
+#define BITMAP_SELECT_SAMPLE 8192
+#define rank_words(r) (((r)->size + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS)
+#define rank_supers(r) (rank_words(r) / RANK_SUPER_WORDS + 1)
+#define rank_blocks(r) (rank_words(r) / RANK_BLOCK_WORDS + 1)
+
+// Word w of the indexed bitmap, without the bits past its size
+static inline bitmap_t rank_word(const bitmap_rank_t *r, size_t w) {
+  size_t rest = r->size % BITMAP_WORD_BITS;
+  if (w >= rank_words(r))
+    return 0;
+  if (rest && w == rank_words(r) - 1)
+    return r->bitmap[w] & (((bitmap_t)1 << rest) - 1);
+  return r->bitmap[w];
+}
+
+void mk_bitmap_rank(bitmap_rank_t *r, const bitmap_t *bitmap, size_t bitmap_size) {
+  *r = (bitmap_rank_t) { .bitmap = bitmap, .size = bitmap_size };
+  r->supers = malloc(rank_supers(r) * sizeof(uint64_t));
+  r->blocks = malloc(rank_blocks(r) * sizeof(uint16_t));
+  bitmap_rank_rebuild(r);
+}
+
+void bitmap_rank_rebuild(bitmap_rank_t *r) {
+  size_t total = 0, super = 0;
+  for (size_t b = 0; b < rank_blocks(r); b++) {
+    size_t w = b * RANK_BLOCK_WORDS;
+    if (w % RANK_SUPER_WORDS == 0)
+      r->supers[w / RANK_SUPER_WORDS] = total;
+    r->blocks[b] = total - r->supers[w / RANK_SUPER_WORDS];
+    for (size_t end = w + RANK_BLOCK_WORDS; w < end; w++)
+      total += popcount_word(rank_word(r, w));
+  }
+  r->ones = total;
+
+  free(r->samples);
+  r->samples = malloc((r->ones / BITMAP_SELECT_SAMPLE + 2) * sizeof(size_t));
+  for (size_t j = 0; j * BITMAP_SELECT_SAMPLE < r->ones; j++) {
+    super = j ? r->samples[j - 1] : 0;
+    while (super + 1 < rank_supers(r) && r->supers[super + 1] <= j * BITMAP_SELECT_SAMPLE)
+      super++;
+    r->samples[j] = super;
+  }
+  // sentinel bounding the search for the last sample
+  r->samples[(r->ones + BITMAP_SELECT_SAMPLE - 1) / BITMAP_SELECT_SAMPLE] = rank_supers(r) - 1;
+}
+
+void destroy_bitmap_rank(bitmap_rank_t *r) {
+  free(r->supers);
+  free(r->blocks);
+  free(r->samples);
+}
+
+size_t bitmap_rank(const bitmap_rank_t *r, size_t idx) {
+  size_t w = idx / BITMAP_WORD_BITS, rest = idx % BITMAP_WORD_BITS;
+  size_t rank = r->supers[w / RANK_SUPER_WORDS] + r->blocks[w / RANK_BLOCK_WORDS];
+  for (size_t x = w - w % RANK_BLOCK_WORDS; x < w; x++)
+    rank += popcount_word(rank_word(r, x));
+  if (rest)
+    rank += popcount_word(rank_word(r, w) & (((bitmap_t)1 << rest) - 1));
+  return rank;
+}
+
+size_t bitmap_select(const bitmap_rank_t *r, size_t k) {
+  size_t lo, hi, b, last_block;
+  if (k >= r->ones)
+    return r->size;
+  // last superblock starting at or before the k-th bit, between the two nearest samples
+  lo = r->samples[k / BITMAP_SELECT_SAMPLE];
+  hi = r->samples[k / BITMAP_SELECT_SAMPLE + 1];
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo + 1) / 2;
+    if (r->supers[mid] <= k)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  k -= r->supers[lo];
+
+  b = lo * (RANK_SUPER_WORDS / RANK_BLOCK_WORDS);
+  last_block = b + RANK_SUPER_WORDS / RANK_BLOCK_WORDS - 1;
+  if (last_block >= rank_blocks(r))
+    last_block = rank_blocks(r) - 1;
+  while (b < last_block && r->blocks[b + 1] <= k)
+    b++;
+  k -= r->blocks[b];
+
+  for (size_t w = b * RANK_BLOCK_WORDS;; w++) {
+    bitmap_t word = rank_word(r, w);
+    size_t count = popcount_word(word);
+    if (k < count) {
+      // drop the k lowest set bits of the word
+      for (; k; k--)
+        word &= word - 1;
+      return w * BITMAP_WORD_BITS + __builtin_ctzll(word);
+    }
+    k -= count;
+  }
 }
 
 void print_bitmap(bitmap_t *bitmap, size_t size) {
@@ -0,0 +1,161 @@
+#ifndef __HBITMAP_H
+#define __HBITMAP_H
+
+// Hierarchical bitmap. On top of the bits are summary levels where each bit describes one
+// 64-bit word of the level below, so finding a set or a free bit takes a ctz per level instead of
+// a scan over the whole bitmap:
+//  * nonempty: bit i is set if word i of the level below has a set bit
+//  * notfull:  bit i is set if word i of the level below has an unset bit
+// The top level of each summary is a single word.
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "bitmap.h"
+
+// 64^10 bits is more than any address space holds
+#define HBITMAP_MAX_LEVELS 10
+
+typedef struct {
+  size_t size;                                    // Number of bits
+  int levels;                                     // Number of summary levels above the bits
+  size_t words[HBITMAP_MAX_LEVELS + 1];           // Number of words in each level, starting with the bits
+  bitmap_t *bits;
+  bitmap_t *nonempty[HBITMAP_MAX_LEVELS + 1];     // nonempty[0] is bits
+  bitmap_t *notfull[HBITMAP_MAX_LEVELS + 1];      // notfull[0] is unused; it is the complement of bits
+} hbitmap_t;
+
+// Make a new hierarchical bitmap with the given capacity, with every bit unset
+void mk_hbitmap(hbitmap_t *h, size_t capacity);
+// Destroy the given hierarchical bitmap
+void destroy_hbitmap(hbitmap_t *h);
+// Recompute the summary levels after modifying h->bits directly, e.g. with bitmap_set_range
+void hbitmap_rebuild(hbitmap_t *h);
+// Return true if the given bit is set
+bool hbitmap_bit_set(const hbitmap_t *h, size_t idx);
+// Turn the given bit on or off
+void hbitmap_set_bit(hbitmap_t *h, size_t idx, bit_t value);
+// Return the index of the first set bit at or after idx, or the capacity if there is none
+size_t hbitmap_find_next_set(const hbitmap_t *h, size_t idx);
+// Return the index of the first unset bit at or after idx, or the capacity if there is none
+size_t hbitmap_find_next_zero(const hbitmap_t *h, size_t idx);
+// Set the first unset bit and return its index, or return the capacity if every bit is set
+size_t hbitmap_alloc(hbitmap_t *h);
+
+#endif // __HBITMAP_H
+
+#ifdef HBITMAP_IMPLEMENTATION
+#undef HBITMAP_IMPLEMENTATION
+
+#include <stdlib.h>
+#define BITMAP_IMPLEMENTATION
+#include "bitmap.h"
+
+void mk_hbitmap(hbitmap_t *h, size_t capacity) {
+  *h = (hbitmap_t) { .size = capacity };
+  h->words[0] = capacity ? (capacity + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS : 1;
+  while (h->words[h->levels] > 1) {
+    h->levels++;
+    h->words[h->levels] = (h->words[h->levels - 1] + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+  }
+  h->bits = h->nonempty[0] = calloc(h->words[0], sizeof(bitmap_t));
+  for (int l = 1; l <= h->levels; l++) {
+    h->nonempty[l] = calloc(h->words[l], sizeof(bitmap_t));
+    h->notfull[l] = calloc(h->words[l], sizeof(bitmap_t));
+  }
+  hbitmap_rebuild(h);
+}
+
+void destroy_hbitmap(hbitmap_t *h) {
+  free(h->bits);
+  for (int l = 1; l <= h->levels; l++) {
+    free(h->nonempty[l]);
+    free(h->notfull[l]);
+  }
+}
+
+// Word i of a level. The complement of the bits stands in for level 0 of notfull.
+static inline bitmap_t level_word(const hbitmap_t *h, bitmap_t *const *summary, int level, size_t i) {
+  if (level == 0 && summary == h->notfull)
+    return ~h->bits[i];
+  return summary[level][i];
+}
+
+void hbitmap_rebuild(hbitmap_t *h) {
+  for (int l = 1; l <= h->levels; l++) {
+    bitmap_clear_range(h->nonempty[l], 0, h->words[l] * BITMAP_WORD_BITS);
+    bitmap_clear_range(h->notfull[l], 0, h->words[l] * BITMAP_WORD_BITS);
+    for (size_t i = 0; i < h->words[l - 1]; i++) {
+      if (level_word(h, h->nonempty, l - 1, i))
+        set_bit(h->nonempty[l], i, 1);
+      if (level_word(h, h->notfull, l - 1, i))
+        set_bit(h->notfull[l], i, 1);
+    }
+  }
+}
+
+bool hbitmap_bit_set(const hbitmap_t *h, size_t idx) {
+  return bit_set(h->bits, idx);
+}
+
+// Set or clear summary bit i of the given level, and update the levels above when the word becomes empty or non-empty
+static void summary_update(hbitmap_t *h, bitmap_t **summary, int level, size_t i, bit_t value) {
+  for (; level <= h->levels; level++, i /= BITMAP_WORD_BITS) {
+    bitmap_t *word = &summary[level][i / BITMAP_WORD_BITS];
+    bitmap_t old = *word;
+    set_bit(summary[level], i, value);
+    if ((old == 0) == (*word == 0))
+      break;
+  }
+}
+
+void hbitmap_set_bit(hbitmap_t *h, size_t idx, bit_t value) {
+  size_t w = idx / BITMAP_WORD_BITS;
+  bitmap_t old = h->bits[w];
+  set_bit(h->bits, idx, value);
+  if ((old == 0) != (h->bits[w] == 0))
+    summary_update(h, h->nonempty, 1, w, h->bits[w] != 0);
+  if ((~old == 0) != (~h->bits[w] == 0))
+    summary_update(h, h->notfull, 1, w, ~h->bits[w] != 0);
+}
+
+// Climb the levels until a word with a set bit at or after the current position is found,
+// then descend to the first set bit below it.
+static size_t hbitmap_find(const hbitmap_t *h, bitmap_t *const *summary, size_t idx) {
+  size_t pos = idx;
+  int level = 0;
+  bitmap_t word;
+  if (idx >= h->size)
+    return h->size;
+  for (;;) {
+    if (pos / BITMAP_WORD_BITS >= h->words[level])
+      return h->size;
+    word = level_word(h, summary, level, pos / BITMAP_WORD_BITS) & (~(bitmap_t)0 << (pos % BITMAP_WORD_BITS));
+    if (word)
+      break;
+    if (level == h->levels)
+      return h->size;
+    pos = pos / BITMAP_WORD_BITS + 1;
+    level++;
+  }
+  pos = pos - pos % BITMAP_WORD_BITS + __builtin_ctzll(word);
+  for (; level > 0; level--)
+    pos = pos * BITMAP_WORD_BITS + __builtin_ctzll(level_word(h, summary, level - 1, pos));
+  return pos < h->size ? pos : h->size;
+}
+
+size_t hbitmap_find_next_set(const hbitmap_t *h, size_t idx) {
+  return hbitmap_find(h, h->nonempty, idx);
+}
+
+size_t hbitmap_find_next_zero(const hbitmap_t *h, size_t idx) {
+  return hbitmap_find(h, h->notfull, idx);
+}
+
+size_t hbitmap_alloc(hbitmap_t *h) {
+  size_t idx = hbitmap_find(h, h->notfull, 0);
+  if (idx < h->size)
+    hbitmap_set_bit(h, idx, 1);
+  return idx;
+}
+
+#endif // HBITMAP_IMPLEMENTATION
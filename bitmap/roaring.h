@@ -0,0 +1,464 @@
+#ifndef __ROARING_H
+#define __ROARING_H
+
+// Compressed bitmap for sparse or clustered sets.
+// The index space is split into chunks of 2^16 bits. Each non-empty chunk is stored in a container:
+//  * array:  sorted list of the set bits, used while at most ROARING_ARRAY_MAX bits are set
+//  * bitset: a dense 2^16 bit bitmap_t, used for fuller chunks
+//  * run:    sorted list of runs of set bits, produced by roaring_optimize when it is the smallest
+// Containers are kept in a directory sorted by chunk.
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "bitmap.h"
+
+#define ROARING_CHUNK_BITS 65536
+#define ROARING_ARRAY_MAX 4096
+#define ROARING_BITSET_WORDS (ROARING_CHUNK_BITS / 64)
+
+typedef enum {
+  ROARING_ARRAY,
+  ROARING_BITSET,
+  ROARING_RUN,
+} roaring_kind;
+
+typedef struct {
+  uint16_t start;
+  uint16_t length; // number of bits in the run minus one
+} roaring_run;
+
+typedef struct {
+  size_t chunk;          // index / ROARING_CHUNK_BITS of the bits in this container
+  roaring_kind kind;
+  uint32_t cardinality;  // number of set bits
+  uint32_t n;            // number of entries in array or runs
+  uint32_t capacity;     // allocated entries in array or runs
+  union {
+    uint16_t *array;
+    bitmap_t *bitset;
+    roaring_run *runs;
+  } data;
+} roaring_container;
+
+typedef struct {
+  size_t count;
+  size_t capacity;
+  roaring_container *containers;
+} roaring_t;
+
+// Make a new, empty compressed bitmap
+roaring_t *mk_roaring(void);
+// Destroy the given compressed bitmap
+void destroy_roaring(roaring_t *r);
+// Return true if the given bit is set
+bool roaring_bit_set(const roaring_t *r, size_t idx);
+// Turn the given bit on or off
+void roaring_set_bit(roaring_t *r, size_t idx, bit_t value);
+// Toggle the given bit
+void roaring_toggle_bit(roaring_t *r, size_t idx);
+// Count the set bits
+size_t roaring_sum(const roaring_t *r);
+// Convert containers to run containers where that is smaller. Useful after bulk updates of clustered sets.
+void roaring_optimize(roaring_t *r);
+// Set algebra. Each returns a new compressed bitmap.
+roaring_t *roaring_and(const roaring_t *a, const roaring_t *b);
+roaring_t *roaring_or(const roaring_t *a, const roaring_t *b);
+roaring_t *roaring_xor(const roaring_t *a, const roaring_t *b);
+// a and not b
+roaring_t *roaring_andnot(const roaring_t *a, const roaring_t *b);
+// Compress the first bitmap_size bits of a dense bitmap
+roaring_t *roaring_from_bitmap(const bitmap_t *bitmap, size_t bitmap_size);
+// Make a dense bitmap with the given capacity holding the bits of r below bitmap_size
+bitmap_t *roaring_to_bitmap(const roaring_t *r, size_t bitmap_size);
+
+#endif // __ROARING_H
+
+#ifdef ROARING_IMPLEMENTATION
+#undef ROARING_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+#define BITMAP_IMPLEMENTATION
+#include "bitmap.h"
+
+#define chunk_of(idx) ((idx) / ROARING_CHUNK_BITS)
+#define low_of(idx) ((uint16_t)((idx) % ROARING_CHUNK_BITS))
+
+roaring_t *mk_roaring(void) {
+  return calloc(1, sizeof(roaring_t));
+}
+
+static void free_container(roaring_container *c) {
+  free(c->data.array);
+}
+
+void destroy_roaring(roaring_t *r) {
+  if (!r)
+    return;
+  for (size_t i = 0; i < r->count; i++)
+    free_container(&r->containers[i]);
+  free(r->containers);
+  free(r);
+}
+
+// Index of the container for chunk, or the position where it should be inserted
+static size_t find_container(const roaring_t *r, size_t chunk, bool *found) {
+  size_t lo = 0, hi = r->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (r->containers[mid].chunk < chunk)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *found = lo < r->count && r->containers[lo].chunk == chunk;
+  return lo;
+}
+
+// Position of value in a sorted array, or where it should be inserted
+static uint32_t array_search(const uint16_t *array, uint32_t n, uint16_t value, bool *found) {
+  uint32_t lo = 0, hi = n;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (array[mid] < value)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *found = lo < n && array[lo] == value;
+  return lo;
+}
+
+static bool container_contains(const roaring_container *c, uint16_t low) {
+  bool found;
+  switch (c->kind) {
+    case ROARING_ARRAY:
+      array_search(c->data.array, c->n, low, &found);
+      return found;
+    case ROARING_BITSET:
+      return bit_set(c->data.bitset, low);
+    case ROARING_RUN: {
+      // last run starting at or before low
+      uint32_t lo = 0, hi = c->n;
+      while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (c->data.runs[mid].start <= low)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+      return lo > 0 && low - c->data.runs[lo - 1].start <= c->data.runs[lo - 1].length;
+    }
+  }
+  return false;
+}
+
+// Write the bits of a container into a zeroed ROARING_BITSET_WORDS buffer
+static void container_expand(const roaring_container *c, bitmap_t *bitset) {
+  switch (c->kind) {
+    case ROARING_ARRAY:
+      for (uint32_t i = 0; i < c->n; i++)
+        set_bit(bitset, c->data.array[i], 1);
+      break;
+    case ROARING_BITSET:
+      memcpy(bitset, c->data.bitset, ROARING_BITSET_WORDS * sizeof(bitmap_t));
+      break;
+    case ROARING_RUN:
+      for (uint32_t i = 0; i < c->n; i++)
+        bitmap_set_range(bitset, c->data.runs[i].start, (size_t)c->data.runs[i].start + c->data.runs[i].length + 1);
+      break;
+  }
+}
+
+// Make an array or bitset container from a bitset with the given number of set bits. The bitset is copied.
+static roaring_container container_from_bitset(size_t chunk, const bitmap_t *bitset, uint32_t cardinality) {
+  roaring_container c = { .chunk = chunk, .cardinality = cardinality };
+  if (cardinality <= ROARING_ARRAY_MAX) {
+    c.kind = ROARING_ARRAY;
+    c.capacity = cardinality ? cardinality : 1;
+    c.data.array = malloc(c.capacity * sizeof(uint16_t));
+    for (size_t idx = bitmap_find_first_set(bitset, ROARING_CHUNK_BITS); idx < ROARING_CHUNK_BITS;
+        idx = bitmap_find_next_set(bitset, ROARING_CHUNK_BITS, idx + 1))
+      c.data.array[c.n++] = idx;
+  } else {
+    c.kind = ROARING_BITSET;
+    c.data.bitset = malloc(ROARING_BITSET_WORDS * sizeof(bitmap_t));
+    memcpy(c.data.bitset, bitset, ROARING_BITSET_WORDS * sizeof(bitmap_t));
+  }
+  return c;
+}
+
+static roaring_container container_copy(const roaring_container *c) {
+  roaring_container copy = *c;
+  size_t bytes;
+  switch (c->kind) {
+    case ROARING_ARRAY: bytes = c->capacity * sizeof(uint16_t); break;
+    case ROARING_RUN: bytes = c->capacity * sizeof(roaring_run); break;
+    default: bytes = ROARING_BITSET_WORDS * sizeof(bitmap_t); break;
+  }
+  copy.data.array = malloc(bytes);
+  memcpy(copy.data.array, c->data.array, bytes);
+  return copy;
+}
+
+// Run containers are read only; turn one back into an array or bitset before modifying it
+static void container_decompress(roaring_container *c) {
+  bitmap_t bitset[ROARING_BITSET_WORDS] = { 0 };
+  if (c->kind != ROARING_RUN)
+    return;
+  container_expand(c, bitset);
+  free_container(c);
+  *c = container_from_bitset(c->chunk, bitset, c->cardinality);
+}
+
+static void container_add(roaring_container *c, uint16_t low) {
+  bool found;
+  container_decompress(c);
+  if (c->kind == ROARING_BITSET) {
+    if (!bit_set(c->data.bitset, low)) {
+      set_bit(c->data.bitset, low, 1);
+      c->cardinality++;
+    }
+    return;
+  }
+  uint32_t pos = array_search(c->data.array, c->n, low, &found);
+  if (found)
+    return;
+  if (c->n == ROARING_ARRAY_MAX) {
+    // full array; switch to a bitset
+    bitmap_t bitset[ROARING_BITSET_WORDS] = { 0 };
+    container_expand(c, bitset);
+    set_bit(bitset, low, 1);
+    free_container(c);
+    *c = container_from_bitset(c->chunk, bitset, ROARING_ARRAY_MAX + 1);
+    return;
+  }
+  if (c->n == c->capacity) {
+    c->capacity *= 2;
+    c->data.array = realloc(c->data.array, c->capacity * sizeof(uint16_t));
+  }
+  memmove(c->data.array + pos + 1, c->data.array + pos, (c->n - pos) * sizeof(uint16_t));
+  c->data.array[pos] = low;
+  c->n++;
+  c->cardinality++;
+}
+
+static void container_remove(roaring_container *c, uint16_t low) {
+  bool found;
+  container_decompress(c);
+  if (c->kind == ROARING_BITSET) {
+    if (!bit_set(c->data.bitset, low))
+      return;
+    set_bit(c->data.bitset, low, 0);
+    if (--c->cardinality == ROARING_ARRAY_MAX) {
+      roaring_container array = container_from_bitset(c->chunk, c->data.bitset, c->cardinality);
+      free_container(c);
+      *c = array;
+    }
+    return;
+  }
+  uint32_t pos = array_search(c->data.array, c->n, low, &found);
+  if (!found)
+    return;
+  memmove(c->data.array + pos, c->data.array + pos + 1, (c->n - pos - 1) * sizeof(uint16_t));
+  c->n--;
+  c->cardinality--;
+}
+
+// Insert a container at position pos of the directory
+static void insert_container(roaring_t *r, size_t pos, roaring_container c) {
+  if (r->count == r->capacity) {
+    r->capacity = r->capacity ? r->capacity * 2 : 4;
+    r->containers = realloc(r->containers, r->capacity * sizeof(roaring_container));
+  }
+  memmove(r->containers + pos + 1, r->containers + pos, (r->count - pos) * sizeof(roaring_container));
+  r->containers[pos] = c;
+  r->count++;
+}
+
+static void remove_container(roaring_t *r, size_t pos) {
+  free_container(&r->containers[pos]);
+  memmove(r->containers + pos, r->containers + pos + 1, (r->count - pos - 1) * sizeof(roaring_container));
+  r->count--;
+}
+
+// Append a container, dropping it if it is empty. Containers must be appended in chunk order.
+static void append_container(roaring_t *r, roaring_container c) {
+  if (c.cardinality == 0) {
+    free_container(&c);
+    return;
+  }
+  insert_container(r, r->count, c);
+}
+
+bool roaring_bit_set(const roaring_t *r, size_t idx) {
+  bool found;
+  size_t pos = find_container(r, chunk_of(idx), &found);
+  return found && container_contains(&r->containers[pos], low_of(idx));
+}
+
+void roaring_set_bit(roaring_t *r, size_t idx, bit_t value) {
+  bool found;
+  size_t pos = find_container(r, chunk_of(idx), &found);
+  if (value) {
+    if (!found) {
+      roaring_container c = { .chunk = chunk_of(idx), .kind = ROARING_ARRAY, .capacity = 4 };
+      c.data.array = malloc(c.capacity * sizeof(uint16_t));
+      insert_container(r, pos, c);
+    }
+    container_add(&r->containers[pos], low_of(idx));
+  } else if (found) {
+    container_remove(&r->containers[pos], low_of(idx));
+    if (r->containers[pos].cardinality == 0)
+      remove_container(r, pos);
+  }
+}
+
+void roaring_toggle_bit(roaring_t *r, size_t idx) {
+  roaring_set_bit(r, idx, !roaring_bit_set(r, idx));
+}
+
+size_t roaring_sum(const roaring_t *r) {
+  size_t sum = 0;
+  for (size_t i = 0; i < r->count; i++)
+    sum += r->containers[i].cardinality;
+  return sum;
+}
+
+void roaring_optimize(roaring_t *r) {
+  bitmap_t bitset[ROARING_BITSET_WORDS];
+  for (size_t i = 0; i < r->count; i++) {
+    roaring_container *c = &r->containers[i];
+    uint32_t runs = 0;
+    size_t bytes;
+    if (c->kind == ROARING_RUN)
+      continue;
+    memset(bitset, 0, sizeof(bitset));
+    container_expand(c, bitset);
+    for (size_t start = bitmap_find_first_set(bitset, ROARING_CHUNK_BITS); start < ROARING_CHUNK_BITS;
+        start = bitmap_find_next_set(bitset, ROARING_CHUNK_BITS, bitmap_find_next_zero(bitset, ROARING_CHUNK_BITS, start)))
+      runs++;
+    bytes = c->kind == ROARING_ARRAY ? c->n * sizeof(uint16_t) : ROARING_BITSET_WORDS * sizeof(bitmap_t);
+    if (runs * sizeof(roaring_run) >= bytes)
+      continue;
+
+    roaring_container run = { .chunk = c->chunk, .kind = ROARING_RUN, .cardinality = c->cardinality, .capacity = runs };
+    run.data.runs = malloc(runs * sizeof(roaring_run));
+    for (size_t start = bitmap_find_first_set(bitset, ROARING_CHUNK_BITS); start < ROARING_CHUNK_BITS;) {
+      size_t end = bitmap_find_next_zero(bitset, ROARING_CHUNK_BITS, start);
+      run.data.runs[run.n++] = (roaring_run) { .start = start, .length = end - start - 1 };
+      start = bitmap_find_next_set(bitset, ROARING_CHUNK_BITS, end);
+    }
+    free_container(c);
+    *c = run;
+  }
+}
+
+// Intersect two sorted arrays without expanding them
+static roaring_container array_and(const roaring_container *a, const roaring_container *b) {
+  roaring_container c = { .chunk = a->chunk, .kind = ROARING_ARRAY };
+  c.capacity = a->n < b->n ? a->n : b->n;
+  c.data.array = malloc((c.capacity ? c.capacity : 1) * sizeof(uint16_t));
+  for (uint32_t i = 0, j = 0; i < a->n && j < b->n;) {
+    if (a->data.array[i] < b->data.array[j]) {
+      i++;
+    } else if (a->data.array[i] > b->data.array[j]) {
+      j++;
+    } else {
+      c.data.array[c.n++] = a->data.array[i];
+      i++, j++;
+    }
+  }
+  c.cardinality = c.n;
+  return c;
+}
+
+typedef void (*bitset_op)(bitmap_t *out, const bitmap_t *a, const bitmap_t *b, size_t bitmap_size);
+
+// Combine two containers for the same chunk by expanding both to bitsets
+static roaring_container container_op(const roaring_container *a, const roaring_container *b, bitset_op op) {
+  bitmap_t left[ROARING_BITSET_WORDS] = { 0 }, right[ROARING_BITSET_WORDS] = { 0 };
+  container_expand(a, left);
+  container_expand(b, right);
+  op(left, left, right, ROARING_CHUNK_BITS);
+  return container_from_bitset(a->chunk, left, bitmap_sum(left, ROARING_CHUNK_BITS));
+}
+
+// Merge the directories of a and b. Chunks present in only one of them are copied if keep_a / keep_b is set.
+static roaring_t *roaring_op(const roaring_t *a, const roaring_t *b, bitset_op op, bool keep_a, bool keep_b) {
+  roaring_t *r = mk_roaring();
+  size_t i = 0, j = 0;
+  while (i < a->count || j < b->count) {
+    const roaring_container *ca = i < a->count ? &a->containers[i] : NULL;
+    const roaring_container *cb = j < b->count ? &b->containers[j] : NULL;
+    if (ca && (!cb || ca->chunk < cb->chunk)) {
+      if (keep_a)
+        append_container(r, container_copy(ca));
+      i++;
+    } else if (cb && (!ca || cb->chunk < ca->chunk)) {
+      if (keep_b)
+        append_container(r, container_copy(cb));
+      j++;
+    } else {
+      if (op == bitmap_and && ca->kind == ROARING_ARRAY && cb->kind == ROARING_ARRAY)
+        append_container(r, array_and(ca, cb));
+      else
+        append_container(r, container_op(ca, cb, op));
+      i++, j++;
+    }
+  }
+  return r;
+}
+
+roaring_t *roaring_and(const roaring_t *a, const roaring_t *b) {
+  return roaring_op(a, b, bitmap_and, false, false);
+}
+
+roaring_t *roaring_or(const roaring_t *a, const roaring_t *b) {
+  return roaring_op(a, b, bitmap_or, true, true);
+}
+
+roaring_t *roaring_xor(const roaring_t *a, const roaring_t *b) {
+  return roaring_op(a, b, bitmap_xor, true, true);
+}
+
+roaring_t *roaring_andnot(const roaring_t *a, const roaring_t *b) {
+  return roaring_op(a, b, bitmap_andnot, true, false);
+}
+
+roaring_t *roaring_from_bitmap(const bitmap_t *bitmap, size_t bitmap_size) {
+  roaring_t *r = mk_roaring();
+  bitmap_t bitset[ROARING_BITSET_WORDS];
+  for (size_t start = 0; start < bitmap_size; start += ROARING_CHUNK_BITS) {
+    size_t bits = bitmap_size - start < ROARING_CHUNK_BITS ? bitmap_size - start : ROARING_CHUNK_BITS;
+    size_t cardinality = bitmap_sum(bitmap + start / BITMAP_WORD_BITS, bits);
+    if (!cardinality)
+      continue;
+    memset(bitset, 0, sizeof(bitset));
+    memcpy(bitset, bitmap + start / BITMAP_WORD_BITS, (bits + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS * sizeof(bitmap_t));
+    // drop the bits past bitmap_size
+    bitmap_clear_range(bitset, bits, ROARING_CHUNK_BITS);
+    append_container(r, container_from_bitset(chunk_of(start), bitset, cardinality));
+  }
+  return r;
+}
+
+bitmap_t *roaring_to_bitmap(const roaring_t *r, size_t bitmap_size) {
+  bitmap_t *bitmap = mk_bitmap(bitmap_size);
+  bitmap_t bitset[ROARING_BITSET_WORDS];
+  for (size_t i = 0; i < r->count && r->containers[i].chunk * ROARING_CHUNK_BITS < bitmap_size; i++) {
+    size_t start = r->containers[i].chunk * ROARING_CHUNK_BITS;
+    size_t bits = bitmap_size - start < ROARING_CHUNK_BITS ? bitmap_size - start : ROARING_CHUNK_BITS;
+    memset(bitset, 0, sizeof(bitset));
+    container_expand(&r->containers[i], bitset);
+    bitmap_clear_range(bitset, bits, ROARING_CHUNK_BITS);
+    memcpy(bitmap + start / BITMAP_WORD_BITS, bitset, (bits + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS * sizeof(bitmap_t));
+  }
+  return bitmap;
+}
+
+#undef chunk_of
+#undef low_of
+
+#endif // ROARING_IMPLEMENTATION
@@ -1,11 +1,283 @@
 #define BITMAP_IMPLEMENTATION
 #include "bitmap.h"
+#include <string.h>
+#include <sys/resource.h>
 
 #define LENGTH(X) (sizeof(X) / sizeof(X[0]))
 #define ASSERT(X) if (!(X)) { printf("%s:%d: Assertion failed: %s\n", __FILE__, __LINE__, #X); exit(1); }
 #define ASSERT_EQUAL(X, Y) if ((X) != (Y)) { printf("%s:%d: Assertion failed: %s != %s (%zu != %zu)\n", __FILE__, __LINE__, #X, #Y, (size_t)(X), (size_t)(Y)); exit(1); }
 
+// Every popcount implementation the cpu supports must agree with the portable one
+void test_popcount(void) {
+  size_t n = 1000;
+  bitmap_t *words = mk_bitmap(n * BITMAP_WORD_BITS);
+  srand(42);
+  for (size_t i = 0; i < n; i++)
+    words[i] = ((bitmap_t)rand() << 40) ^ ((bitmap_t)rand() << 20) ^ rand();
+  for (size_t len = 0; len < n; len += 37) {
+    size_t expected = bitmap_popcount_portable(words, len);
+    ASSERT_EQUAL(bitmap_popcount(words, len), expected);
+#ifdef BITMAP_X86
+    if (__builtin_cpu_supports("popcnt"))
+      ASSERT_EQUAL(bitmap_popcount_popcnt(words, len), expected);
+    if (__builtin_cpu_supports("avx2"))
+      ASSERT_EQUAL(bitmap_popcount_avx2(words, len), expected);
+    if (__builtin_cpu_supports("avx512bw"))
+      ASSERT_EQUAL(bitmap_popcount_avx512(words, len), expected);
+#endif
+  }
+  // bits past the requested size are not counted
+  words[0] = ~(bitmap_t)0;
+  ASSERT_EQUAL(bitmap_sum(words, 10), 10);
+  ASSERT_EQUAL(bitmap_sum(words, 64), 64);
+  destroy_bitmap(words);
+}
+
+// Range operations and searches must agree with single bit operations
+void test_ranges(void) {
+  size_t size = 1000;
+  bitmap_t *bitmap = mk_bitmap(size);
+  bitmap_t *expected = mk_bitmap(size);
+  size_t ranges[][2] = { { 0, 0 }, { 3, 5 }, { 0, 64 }, { 60, 70 }, { 64, 128 }, { 100, 900 }, { 1, 999 }, { 0, 1000 }, { 500, 501 } };
+  for (size_t r = 0; r < LENGTH(ranges); r++) {
+    size_t start = ranges[r][0], end = ranges[r][1];
+    bitmap_set_range(bitmap, start, end);
+    for (size_t i = start; i < end; i++)
+      set_bit(expected, i, 1);
+    ASSERT(memcmp(bitmap, expected, BITMAP_WORDS(size) * sizeof(bitmap_t)) == 0);
+    bitmap_toggle_range(bitmap, start / 2, end + 3);
+    for (size_t i = start / 2; i < end + 3; i++)
+      toggle_bit(expected, i);
+    ASSERT(memcmp(bitmap, expected, BITMAP_WORDS(size) * sizeof(bitmap_t)) == 0);
+    bitmap_clear_range(bitmap, start + 1, end);
+    for (size_t i = start + 1; i < end; i++)
+      set_bit(expected, i, 0);
+    ASSERT(memcmp(bitmap, expected, BITMAP_WORDS(size) * sizeof(bitmap_t)) == 0);
+
+    for (size_t i = 0; i <= size; i++) {
+      size_t next_set = i, next_zero = i;
+      while (next_set < size && !bit_set(expected, next_set)) next_set++;
+      while (next_zero < size && bit_set(expected, next_zero)) next_zero++;
+      ASSERT_EQUAL(bitmap_find_next_set(bitmap, size, i), next_set);
+      ASSERT_EQUAL(bitmap_find_next_zero(bitmap, size, i), next_zero);
+    }
+  }
+  bitmap_clear_range(bitmap, 0, size);
+  ASSERT_EQUAL(bitmap_find_first_set(bitmap, size), size);
+  set_bit(bitmap, size - 1, 1);
+  ASSERT_EQUAL(bitmap_find_first_set(bitmap, size), size - 1);
+  bitmap_set_range(bitmap, 0, size);
+  ASSERT_EQUAL(bitmap_find_next_zero(bitmap, size, 0), size);
+  destroy_bitmap(bitmap);
+  destroy_bitmap(expected);
+}
+
+// Set operations must agree with single bit operations, in place and out of place
+void test_set_algebra(void) {
+  size_t size = 1013;
+  bitmap_t *a = mk_bitmap(size), *b = mk_bitmap(size), *out = mk_bitmap(size), *copy = mk_bitmap(size);
+  srand(7);
+  for (size_t i = 0; i < size; i++) {
+    set_bit(a, i, rand() % 3 == 0);
+    set_bit(b, i, rand() % 2 == 0);
+  }
+  size_t n_and = 0, n_or = 0, n_xor = 0, n_andnot = 0;
+  for (size_t i = 0; i < size; i++) {
+    n_and += bit_set(a, i) && bit_set(b, i);
+    n_or += bit_set(a, i) || bit_set(b, i);
+    n_xor += bit_set(a, i) != bit_set(b, i);
+    n_andnot += bit_set(a, i) && !bit_set(b, i);
+  }
+  ASSERT_EQUAL(bitmap_and_count(a, b, size), n_and);
+  ASSERT_EQUAL(bitmap_or_count(a, b, size), n_or);
+  ASSERT_EQUAL(bitmap_xor_count(a, b, size), n_xor);
+  ASSERT_EQUAL(bitmap_andnot_count(a, b, size), n_andnot);
+#ifdef BITMAP_X86
+  if (__builtin_cpu_supports("avx2")) {
+    size_t words = size / BITMAP_WORD_BITS;
+    ASSERT_EQUAL(and_count_avx2(a, b, words), and_count_portable(a, b, words));
+    ASSERT_EQUAL(xor_count_avx2(a, b, words), xor_count_portable(a, b, words));
+    and_words_portable(copy, a, b, words);
+    and_words_avx2(out, a, b, words);
+    ASSERT(memcmp(out, copy, words * sizeof(bitmap_t)) == 0);
+  }
+#endif
+
+  bitmap_and(out, a, b, size);
+  for (size_t i = 0; i < size; i++)
+    ASSERT_EQUAL(bit_set(out, i), bit_set(a, i) && bit_set(b, i));
+  bitmap_or(out, a, b, size);
+  for (size_t i = 0; i < size; i++)
+    ASSERT_EQUAL(bit_set(out, i), bit_set(a, i) || bit_set(b, i));
+  bitmap_xor(out, a, b, size);
+  for (size_t i = 0; i < size; i++)
+    ASSERT_EQUAL(bit_set(out, i), bit_set(a, i) != bit_set(b, i));
+  bitmap_andnot(out, a, b, size);
+  for (size_t i = 0; i < size; i++)
+    ASSERT_EQUAL(bit_set(out, i), bit_set(a, i) && !bit_set(b, i));
+  bitmap_not(out, a, size);
+  for (size_t i = 0; i < size; i++)
+    ASSERT_EQUAL(bit_set(out, i), !bit_set(a, i));
+  ASSERT_EQUAL(bitmap_sum(out, size), size - bitmap_sum(a, size));
+
+  memcpy(copy, a, BITMAP_WORDS(size) * sizeof(bitmap_t));
+  bitmap_xor(a, a, b, size);
+  ASSERT_EQUAL(bitmap_sum(a, size), n_xor);
+  bitmap_xor(a, a, b, size);
+  ASSERT(memcmp(a, copy, BITMAP_WORDS(size) * sizeof(bitmap_t)) == 0);
+  destroy_bitmap(a);
+  destroy_bitmap(b);
+  destroy_bitmap(out);
+  destroy_bitmap(copy);
+}
+
+#define ATOMIC_THREADS 4
+#define ATOMIC_BITS 100000
+
+typedef struct {
+  bitmap_t *bitmap;
+  int id;
+  size_t won;
+} atomic_task;
+
+// Every thread tries to claim every bit, starting at a different offset
+void *claim_bits(void *arg) {
+  atomic_task *task = arg;
+  for (size_t i = 0; i < ATOMIC_BITS; i++) {
+    size_t idx = (i + task->id * (ATOMIC_BITS / ATOMIC_THREADS)) % ATOMIC_BITS;
+    task->won += !bitmap_test_and_set(task->bitmap, idx);
+  }
+  return NULL;
+}
+
+// Every thread toggles every bit once
+void *toggle_bits(void *arg) {
+  atomic_task *task = arg;
+  for (size_t i = 0; i < ATOMIC_BITS; i++)
+    bitmap_test_and_toggle(task->bitmap, i);
+  return NULL;
+}
+
+void run_atomic(void *(*fn)(void *), atomic_task *tasks) {
+  pthread_t handles[ATOMIC_THREADS];
+  for (int t = 0; t < ATOMIC_THREADS; t++)
+    ASSERT(pthread_create(&handles[t], NULL, fn, &tasks[t]) == 0);
+  for (int t = 0; t < ATOMIC_THREADS; t++)
+    pthread_join(handles[t], NULL);
+}
+
+void test_atomic(void) {
+  bitmap_t *bitmap = mk_bitmap(ATOMIC_BITS);
+  atomic_task tasks[ATOMIC_THREADS];
+  size_t won = 0;
+  for (int t = 0; t < ATOMIC_THREADS; t++)
+    tasks[t] = (atomic_task) { .bitmap = bitmap, .id = t };
+  run_atomic(claim_bits, tasks);
+  for (int t = 0; t < ATOMIC_THREADS; t++)
+    won += tasks[t].won;
+  // each bit was claimed exactly once
+  ASSERT_EQUAL(won, ATOMIC_BITS);
+  ASSERT_EQUAL(bitmap_sum(bitmap, ATOMIC_BITS), ATOMIC_BITS);
+  // and toggled an even number of times
+  run_atomic(toggle_bits, tasks);
+  ASSERT_EQUAL(bitmap_sum(bitmap, ATOMIC_BITS), ATOMIC_BITS);
+
+  ASSERT(bitmap_test_and_clear(bitmap, 5));
+  ASSERT(!bitmap_test_and_clear(bitmap, 5));
+  ASSERT(!atomic_bit_set(bitmap, 5));
+  ASSERT_EQUAL(bitmap_fetch_and(bitmap, 0, 0), ~(bitmap_t)0 ^ (1 << 5));
+  ASSERT_EQUAL(bitmap_fetch_or(bitmap, 0, 1), 0);
+  ASSERT_EQUAL(bitmap_sum(bitmap, ATOMIC_BITS), ATOMIC_BITS - 63);
+  destroy_bitmap(bitmap);
+}
+
+// rank and select must agree with counting bits one at a time, including after a rebuild
+void test_rank_select(void) {
+  size_t sizes[] = { 0, 1, 64, 511, 512, 4096, 100003 };
+  for (size_t n = 0; n < LENGTH(sizes); n++) {
+    size_t size = sizes[n];
+    bitmap_t *bitmap = mk_bitmap(size);
+    bitmap_rank_t r;
+    srand(size);
+    for (size_t i = 0; i < size; i++)
+      set_bit(bitmap, i, rand() % 5 == 0);
+    // a long empty stretch and a dense stretch
+    if (size > 50000) {
+      bitmap_clear_range(bitmap, 10000, 40000);
+      bitmap_set_range(bitmap, 60000, 90000);
+    }
+    // bits past the size are not indexed
+    bitmap_set_range(bitmap, size, BITMAP_WORDS(size) * BITMAP_WORD_BITS);
+    mk_bitmap_rank(&r, bitmap, size);
+    for (int round = 0; round < 2; round++) {
+      size_t rank = 0;
+      for (size_t i = 0; i < size; i++) {
+        ASSERT_EQUAL(bitmap_rank(&r, i), rank);
+        if (bit_set(bitmap, i)) {
+          ASSERT_EQUAL(bitmap_select(&r, rank), i);
+          rank++;
+        }
+      }
+      ASSERT_EQUAL(bitmap_rank(&r, size), rank);
+      ASSERT_EQUAL(r.ones, rank);
+      ASSERT_EQUAL(bitmap_select(&r, rank), size);
+      bitmap_toggle_range(bitmap, 0, size / 3);
+      bitmap_rank_rebuild(&r);
+    }
+    destroy_bitmap_rank(&r);
+    destroy_bitmap(bitmap);
+  }
+}
+
+// A bitmap over 2^36 bits only commits the pages it touches
+void test_virtual(void) {
+  size_t size = (size_t)1 << 36;
+  struct rusage before, after;
+  bitmap_t *bitmap = mk_bitmap_virtual(size);
+  ASSERT(bitmap);
+  getrusage(RUSAGE_SELF, &before);
+  for (size_t i = 0; i < 1000; i++)
+    set_bit(bitmap, i * (size / 1000) + i, 1);
+  for (size_t i = 0; i < 1000; i++) {
+    ASSERT(bit_set(bitmap, i * (size / 1000) + i));
+    ASSERT(!bit_set(bitmap, i * (size / 1000) + i + 1));
+  }
+  getrusage(RUSAGE_SELF, &after);
+  // 1000 pages, plus some slack for the page tables
+  ASSERT(after.ru_maxrss - before.ru_maxrss < 64 * 1024);
+  destroy_bitmap_mapped(bitmap, size);
+}
+
+// Bits written through one mapping are visible through another, and persist in the file
+void test_file(void) {
+  const char *path = "test_bitmap.map";
+  size_t size = 1 << 20;
+  bitmap_t *a = mk_bitmap_file(path, size), *b = mk_bitmap_file(path, size);
+  ASSERT(a && b);
+  set_bit(a, 12345, 1);
+  bitmap_set_range(a, 1000, 2000);
+  ASSERT(bit_set(b, 12345));
+  ASSERT_EQUAL(bitmap_sum(b, size), 1001);
+  ASSERT(bitmap_sync(a, size) == 0);
+  destroy_bitmap_mapped(a, size);
+  destroy_bitmap_mapped(b, size);
+
+  a = mk_bitmap_file(path, size);
+  ASSERT(a);
+  ASSERT_EQUAL(bitmap_sum(a, size), 1001);
+  ASSERT(bit_set(a, 12345));
+  destroy_bitmap_mapped(a, size);
+  unlink(path);
+}
+
 int main(void) {
+  test_popcount();
+  test_virtual();
+  test_file();
+  test_rank_select();
+  test_atomic();
+  test_ranges();
+  test_set_algebra();
   size_t bitmap_size = 1e8;
   bitmap_t *bitmap = mk_bitmap(bitmap_size);
   // print_bitmap(bitmap, bitmap_size);
@@ -26,6 +298,8 @@ int main(void) {
   }
   // print_bitmap(bitmap, bitmap_size);
   ASSERT_EQUAL(bitmap_sum(bitmap, bitmap_size), (16/2) + (bitmap_size - 16));
+  ASSERT_EQUAL(bitmap_sum_parallel(bitmap, bitmap_size, 4), (16/2) + (bitmap_size - 16));
+  ASSERT_EQUAL(bitmap_sum_parallel(bitmap, bitmap_size - 5, 0), (16/2) + (bitmap_size - 16) - 5);
   for (int i = 0; i < bitmap_size; i++) {
     set_bit(bitmap, i, 0);
   }
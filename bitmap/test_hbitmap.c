@@ -0,0 +1,61 @@
+#define HBITMAP_IMPLEMENTATION
+#include "hbitmap.h"
+// both include the bitmap implementation, which must only be compiled once
+#define ROARING_IMPLEMENTATION
+#include "roaring.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ASSERT(X) if (!(X)) { printf("%s:%d: Assertion failed: %s\n", __FILE__, __LINE__, #X); exit(1); }
+#define ASSERT_EQUAL(X, Y) if ((X) != (Y)) { printf("%s:%d: Assertion failed: %s != %s (%zu != %zu)\n", __FILE__, __LINE__, #X, #Y, (size_t)(X), (size_t)(Y)); exit(1); }
+
+// Searches must agree with the flat bitmap searches
+void assert_searches(const hbitmap_t *h) {
+  for (size_t i = 0; i <= h->size; i += 1 + i / 50) {
+    ASSERT_EQUAL(hbitmap_find_next_set(h, i), bitmap_find_next_set(h->bits, h->size, i));
+    ASSERT_EQUAL(hbitmap_find_next_zero(h, i), bitmap_find_next_zero(h->bits, h->size, i));
+  }
+}
+
+void test_hbitmap(size_t size) {
+  hbitmap_t h;
+  mk_hbitmap(&h, size);
+  assert_searches(&h);
+  srand(size);
+  for (size_t i = 0; i < size / 2 + 10; i++) {
+    size_t idx = rand() % (size ? size : 1);
+    if (size)
+      hbitmap_set_bit(&h, idx, !hbitmap_bit_set(&h, idx));
+  }
+  assert_searches(&h);
+
+  // allocate every free slot, in order
+  size_t expected = bitmap_find_next_zero(h.bits, size, 0);
+  for (size_t allocated = bitmap_sum(h.bits, size); allocated < size; allocated++) {
+    ASSERT_EQUAL(hbitmap_alloc(&h), expected);
+    expected = bitmap_find_next_zero(h.bits, size, expected);
+  }
+  ASSERT_EQUAL(hbitmap_alloc(&h), size);
+  assert_searches(&h);
+
+  // free a few slots again
+  for (size_t i = 0; i < size; i += 1 + size / 7) {
+    hbitmap_set_bit(&h, i, 0);
+    ASSERT_EQUAL(hbitmap_find_next_zero(&h, 0), bitmap_find_next_zero(h.bits, size, 0));
+  }
+  assert_searches(&h);
+
+  // bulk updates through the bits, followed by a rebuild
+  bitmap_clear_range(h.bits, 0, size);
+  bitmap_set_range(h.bits, size / 3, size / 2);
+  hbitmap_rebuild(&h);
+  assert_searches(&h);
+  destroy_hbitmap(&h);
+}
+
+int main(void) {
+  size_t sizes[] = { 0, 1, 63, 64, 65, 4096, 4097, 300000, 1 << 19 };
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    test_hbitmap(sizes[i]);
+  return 0;
+}
@@ -0,0 +1,114 @@
+#define ROARING_IMPLEMENTATION
+#include "roaring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ASSERT(X) if (!(X)) { printf("%s:%d: Assertion failed: %s\n", __FILE__, __LINE__, #X); exit(1); }
+#define ASSERT_EQUAL(X, Y) if ((X) != (Y)) { printf("%s:%d: Assertion failed: %s != %s (%zu != %zu)\n", __FILE__, __LINE__, #X, #Y, (size_t)(X), (size_t)(Y)); exit(1); }
+
+// Compare a compressed bitmap against a dense one, bit by bit
+void assert_same(const roaring_t *r, const bitmap_t *bitmap, size_t size) {
+  ASSERT_EQUAL(roaring_sum(r), bitmap_sum(bitmap, size));
+  for (size_t i = 0; i < size; i++)
+    ASSERT_EQUAL(roaring_bit_set(r, i), bit_set(bitmap, i));
+}
+
+// Sparse bits, a dense chunk and a run of bits, mirrored in a dense bitmap
+void fill(roaring_t *r, bitmap_t *bitmap, size_t size, unsigned seed) {
+  srand(seed);
+  for (int i = 0; i < 3000; i++) {
+    size_t idx = rand() % size;
+    roaring_toggle_bit(r, idx);
+    toggle_bit(bitmap, idx);
+  }
+  for (size_t idx = 3 * ROARING_CHUNK_BITS; idx < 4 * ROARING_CHUNK_BITS; idx += 1 + rand() % 4) {
+    roaring_set_bit(r, idx, 1);
+    set_bit(bitmap, idx, 1);
+  }
+  for (size_t idx = 5 * ROARING_CHUNK_BITS + 100 + seed; idx < 6 * ROARING_CHUNK_BITS + 900; idx++) {
+    roaring_set_bit(r, idx, 1);
+    set_bit(bitmap, idx, 1);
+  }
+}
+
+void test_roaring(void) {
+  size_t size = 8 * ROARING_CHUNK_BITS + 123;
+  roaring_t *a = mk_roaring(), *b = mk_roaring();
+  bitmap_t *da = mk_bitmap(size), *db = mk_bitmap(size), *expected = mk_bitmap(size);
+  fill(a, da, size, 1);
+  fill(b, db, size, 2);
+  assert_same(a, da, size);
+  assert_same(b, db, size);
+
+  // clearing bits shrinks bitset containers back into arrays
+  for (size_t idx = 3 * ROARING_CHUNK_BITS; idx < 4 * ROARING_CHUNK_BITS; idx += 2) {
+    roaring_set_bit(a, idx, 0);
+    set_bit(da, idx, 0);
+  }
+  assert_same(a, da, size);
+
+  struct {
+    roaring_t *(*roaring)(const roaring_t *, const roaring_t *);
+    void (*dense)(bitmap_t *, const bitmap_t *, const bitmap_t *, size_t);
+  } ops[] = {
+    { roaring_and, bitmap_and },
+    { roaring_or, bitmap_or },
+    { roaring_xor, bitmap_xor },
+    { roaring_andnot, bitmap_andnot },
+  };
+  for (int optimized = 0; optimized < 2; optimized++) {
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+      roaring_t *r = ops[i].roaring(a, b);
+      ops[i].dense(expected, da, db, size);
+      assert_same(r, expected, size);
+      destroy_roaring(r);
+    }
+    roaring_optimize(a);
+    roaring_optimize(b);
+    assert_same(a, da, size);
+  }
+
+  // modifying run containers
+  roaring_set_bit(a, 5 * ROARING_CHUNK_BITS + 500, 0);
+  set_bit(da, 5 * ROARING_CHUNK_BITS + 500, 0);
+  roaring_toggle_bit(a, 6 * ROARING_CHUNK_BITS + 950);
+  toggle_bit(da, 6 * ROARING_CHUNK_BITS + 950);
+  assert_same(a, da, size);
+
+  // conversions
+  roaring_t *converted = roaring_from_bitmap(da, size);
+  assert_same(converted, da, size);
+  bitmap_t *back = roaring_to_bitmap(a, size);
+  ASSERT(memcmp(back, da, (size / BITMAP_WORD_BITS) * sizeof(bitmap_t)) == 0);
+  assert_same(a, back, size);
+
+  destroy_roaring(a);
+  destroy_roaring(b);
+  destroy_roaring(converted);
+  destroy_bitmap(da);
+  destroy_bitmap(db);
+  destroy_bitmap(expected);
+  destroy_bitmap(back);
+}
+
+// A few thousand ids spread over 2^32 only allocate the containers they touch
+void test_sparse(void) {
+  roaring_t *r = mk_roaring();
+  size_t ids = 5000;
+  for (size_t i = 0; i < ids; i++)
+    roaring_set_bit(r, i * 858993 + 17, 1);
+  ASSERT_EQUAL(roaring_sum(r), ids);
+  ASSERT(r->count <= ids);
+  for (size_t i = 0; i < ids; i++) {
+    ASSERT(roaring_bit_set(r, i * 858993 + 17));
+    ASSERT(!roaring_bit_set(r, i * 858993 + 18));
+  }
+  destroy_roaring(r);
+}
+
+int main(void) {
+  test_roaring();
+  test_sparse();
+  return 0;
+}
@@ -5,6 +5,16 @@
 #define RESIZE_THRESHOLD 0.75
 #endif
 
+// Hashsets holding at most this many entries keep them inline in the struct and use a linear scan
+#ifndef HASHSET_INLINE_CAPACITY
+#define HASHSET_INLINE_CAPACITY 8
+#endif
+
+// hashset_build uses at most one thread per this many kvps
+#ifndef HASHSET_BUILD_GRAIN
+#define HASHSET_BUILD_GRAIN 16384
+#endif
+
 #include <stddef.h>
 #include <stdbool.h>
 
@@ -30,6 +40,32 @@ typedef size_t (*cmpfunc_t)(const hashset_key, const hashset_key);
 
 typedef char* (*formatfunc)(kvp_t kvp);
 
+// How hashset_build treats kvps whose key occurs more than once in its input
+typedef enum {
+  HASHSET_KEEP_FIRST, // The first occurrence wins, like calling hashset_add for each kvp
+  HASHSET_KEEP_LAST,  // The last occurrence wins, like calling hashset_set for each kvp
+} hashset_duplicates;
+
+#define HASHSET_STRKEY_INLINE 15
+#define HASHSET_STRKEY_LONG 0xff
+
+// Packed string key used by string hashsets. Strings of up to HASHSET_STRKEY_INLINE bytes are
+// stored in the key itself. Longer strings keep a pointer to the string and its first bytes.
+// Two keys can be compared with a couple of word compares, and only long keys with a matching
+// prefix need to follow the pointer.
+typedef union {
+  struct {
+    char data[HASHSET_STRKEY_INLINE];
+    unsigned char remaining; // HASHSET_STRKEY_INLINE - length, so a full key is still NUL terminated
+  } inl;
+  struct {
+    char *string;
+    char prefix[7];
+    unsigned char tag;       // HASHSET_STRKEY_LONG
+  } ext;
+  i64 words[2];
+} hashset_strkey;
+
 typedef struct {
   size_t count;
   size_t capacity;
@@ -37,7 +73,10 @@ typedef struct {
   cmpfunc_t cmpfunc;
   hashset_key *keys;
   hashset_value *values;
-  unsigned char *used;
+  unsigned char *used;        // NULL while the hashset is in inline mode
+  hashset_strkey *strkeys;    // Packed copy of each key, only used by string hashsets
+  bool string_keys;
+  kvp_t inline_kvps[HASHSET_INLINE_CAPACITY]; // the first `count` entries are used in inline mode
 } hashset;
 
 // Returns true if hashset contains the specified key
@@ -49,7 +88,15 @@ bool hashset_set(hashset *h, const kvp_t, hashset_value *removed);
 // Remove a kvp_t from hashset, returning true if the value was removed. The removed value is returned in *removed.
 bool hashset_remove(hashset *h, const hashset_key key, hashset_value *removed);
 // Make a new hashset with a given hash function.
+// If initial_size is at most HASHSET_INLINE_CAPACITY, no memory is allocated until the hashset outgrows it.
 void mk_hashset(hashset *h, const hashfunc_t hashfunc, const cmpfunc_t cmpfunc, size_t initial_size);
+// Make a new hashset with string keys. Keys are hashed with hash_string, and compared by their
+// packed hashset_strkey so short keys never dereference the string.
+void mk_string_hashset(hashset *h, size_t initial_size);
+// Fill an empty hashset made with mk_hashset or mk_string_hashset from n kvps, returning the number of keys added.
+// The final table is allocated up front and filled by up to `threads` threads (0: one per online cpu).
+// Which occurrence of a duplicate key is kept is decided by `duplicates` and does not depend on the thread count.
+size_t hashset_build(hashset *h, const kvp_t *kvps, size_t n, hashset_duplicates duplicates, int threads);
 // Destroy a hashset, freeign keys and values
 void destroy_hashset(hashset *h);
 // Hash function suitable for integer keys
@@ -62,6 +109,10 @@ size_t hash_pointer(const hashset_key);
 void hashset_print(hashset *h, formatfunc f);
 // Wrapper around strcmp from <string.h> that accepts null pointers
 size_t hashset_strcmp(const hashset_key a, const hashset_key b);
+// Pack a string into a hashset_strkey. Long strings are referenced, not copied.
+hashset_strkey hashset_mk_strkey(const char *str);
+// Returns true if two packed string keys hold equal strings
+bool hashset_strkey_equal(const hashset_strkey *a, const hashset_strkey *b);
 
 #ifdef HASHSET_IMPLEMENTATION
 
@@ -69,6 +120,8 @@ size_t hashset_strcmp(const hashset_key a, const hashset_key b);
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
+#include <unistd.h>
 
 const size_t coefficients[] = { 1073741827, 1073741831, 1073741833, 1073741839, 1073741843, 1073741857, 1073741891, 1073741909, 1073741939, 1073741953, 1073741969, 1073741971, 1073741987, 1073741993, 1073742037, 1073742053, 1073742073, 1073742077, 1073742091, 1073742113, 1073742169, 1073742203, 1073742209, 1073742223, 1073742233, 1073742259, 1073742277, 1073742289, 1073742343, 1073742353, 1073742361, 1073742391, 1073742403, 1073742463, 1073742493, 1073742517, 1073742583, 1073742623, 1073742653, 1073742667, 1073742671, 1073742673, 1073742707, 1073742713, 1073742721, 1073742731, 1073742767, 1073742773, 1073742811, 1073742851, 1073742853, 1073742881, 1073742889, 1073742913, 1073742931, 1073742937, 1073742959, 1073742983, 1073743007, 1073743037, 1073743049, 1073743051, 1073743079, 1073743091, 1073743093, 1073743123, 1073743129, 1073743141, 1073743159, 1073743163, 1073743189, 1073743199, 1073743207, 1073743243, 1073743291, 1073743303, 1073743313, 1073743327, 1073743331, 1073743337, 1073743381, 1073743387, 1073743393, 1073743397, 1073743403, 1073743417, 1073743421, 1073743427, 1073743457, 1073743459, 1073743469, 1073743501, 1073743507, 1073743513, 1073743543, 1073743577, 1073743591, 1073743633, 1073743739, 1073743757, };
 const size_t n_coefficients = sizeof(coefficients) / sizeof(coefficients[0]);
@@ -102,6 +155,33 @@ size_t hashset_strcmp(const hashset_key a, const hashset_key b) {
   return strcmp(a.string, b.string);
 }
 
+hashset_strkey hashset_mk_strkey(const char *str) {
+  hashset_strkey k = { .words = { 0, 0 } };
+  size_t len = str ? strnlen(str, HASHSET_STRKEY_INLINE + 1) : HASHSET_STRKEY_INLINE + 1;
+  if (len <= HASHSET_STRKEY_INLINE) {
+    memcpy(k.inl.data, str, len);
+    k.inl.remaining = HASHSET_STRKEY_INLINE - len;
+  } else {
+    k.ext.string = (char*)str;
+    if (str)
+      memcpy(k.ext.prefix, str, sizeof(k.ext.prefix));
+    k.ext.tag = HASHSET_STRKEY_LONG;
+  }
+  return k;
+}
+
+bool hashset_strkey_equal(const hashset_strkey *a, const hashset_strkey *b) {
+  // The second word holds the length of short keys, or the prefix of long keys
+  if (a->words[1] != b->words[1])
+    return false;
+  // The first word holds the rest of short keys, or the pointer of long keys
+  if (a->words[0] == b->words[0])
+    return true;
+  if (a->ext.tag != HASHSET_STRKEY_LONG || !a->ext.string || !b->ext.string)
+    return false;
+  return strcmp(a->ext.string + sizeof(a->ext.prefix), b->ext.string + sizeof(b->ext.prefix)) == 0;
+}
+
 // Assume p > 3 and p is odd
 bool is_prime(size_t p) {
   size_t limit = (size_t)sqrt(p);
@@ -123,32 +203,65 @@ size_t default_comparer(hashset_key a, hashset_key b) {
   return a.integer - b.integer;
 }
 
+// Allocate the hashed layout with sz slots
+void alloc_slots(hashset *h, size_t sz) {
+  h->capacity = sz;
+  h->keys = calloc(sz, sizeof(hashset_key));
+  h->values = calloc(sz, sizeof(hashset_value));
+  h->used = calloc(sz, 1);
+  if (h->string_keys)
+    h->strkeys = calloc(sz, sizeof(hashset_strkey));
+}
+
 void mk_hashset(hashset *h, hashfunc_t hashfunc, cmpfunc_t cmpfunc, size_t sz) {
   *h = (hashset) { 0 };
-  h->capacity = sz;
   h->hashfunc = hashfunc;
   h->cmpfunc = cmpfunc ? cmpfunc : default_comparer;
-  if (sz) {
-    h->keys = calloc(sz, sizeof(hashset_key));
-    h->values = calloc(sz, sizeof(hashset_value));
-    h->used = calloc(sz, 1);
-  }
+  if (sz > HASHSET_INLINE_CAPACITY)
+    alloc_slots(h, sz);
+}
+
+void mk_string_hashset(hashset *h, size_t sz) {
+  mk_hashset(h, hash_string, hashset_strcmp, 0);
+  h->string_keys = true;
+  if (sz > HASHSET_INLINE_CAPACITY)
+    alloc_slots(h, sz);
 }
 
 void destroy_hashset(hashset *h) {
   free(h->keys);
   free(h->values);
   free(h->used);
+  free(h->strkeys);
 }
 
 #define next_slot(slot) (((slot) + 1) % h->capacity)
+#define is_inline(h) ((h)->used == NULL)
+// String hashsets compare packed keys; other hashsets use their cmpfunc
+#define slot_equal(h, slot, key, packed) \
+  ((h)->strkeys ? hashset_strkey_equal(&(h)->strkeys[slot], &(packed)) : (h)->cmpfunc((h)->keys[slot], (key)) == 0)
+
+// Linear scan of the inline entries. No hashing is done while the hashset is small.
+bool inline_find(const hashset *h, const hashset_key key, size_t *index) {
+  for (size_t i = 0; i < h->count; i++) {
+    if (h->cmpfunc(h->inline_kvps[i].key, key) == 0) {
+      if (index)
+        *index = i;
+      return true;
+    }
+  }
+  return false;
+}
 
 bool hashset_contains_key(const hashset *h, const hashset_key key, size_t *index) {
   if (h->count == 0) return false;
   size_t slot;
+  hashset_strkey packed = { .words = { 0, 0 } };
+  if (h->strkeys)
+    packed = hashset_mk_strkey(key.string);
   slot = h->hashfunc(key) % h->capacity;
   while (h->used[slot]) {
-    if (h->cmpfunc(h->keys[slot], key) == 0) {
+    if (slot_equal(h, slot, key, packed)) {
       if (index) 
         *index = slot;
       return true;
@@ -161,6 +274,13 @@ bool hashset_contains_key(const hashset *h, const hashset_key key, size_t *index
 bool hashset_get(const hashset *h, const hashset_key key, hashset_value *value) {
   if (h->count == 0) return false;
   size_t index;
+  if (is_inline(h)) {
+    if (inline_find(h, key, &index)) {
+      *value = h->inline_kvps[index].value;
+      return true;
+    }
+    return false;
+  }
   if (hashset_contains_key(h, key, &index)) {
     *value = h->values[index];
     return true;
@@ -170,14 +290,19 @@ bool hashset_get(const hashset *h, const hashset_key key, hashset_value *value)
 
 bool hash_insert(hashset *h, kvp_t kvp) {
   size_t slot;
+  hashset_strkey packed = { .words = { 0, 0 } };
+  if (h->strkeys)
+    packed = hashset_mk_strkey(kvp.key.string);
   slot = h->hashfunc(kvp.key) % h->capacity;
   while (h->used[slot]) {
-    if (h->cmpfunc(h->keys[slot], kvp.key) == 0) {
+    if (slot_equal(h, slot, kvp.key, packed)) {
       return false;
     }
     slot = next_slot(slot);
   }
   h->used[slot] = 1;
+  if (h->strkeys)
+    h->strkeys[slot] = packed;
   h->keys[slot] = kvp.key;
   h->values[slot] = kvp.value;
   h->count++;
@@ -185,12 +310,17 @@ bool hash_insert(hashset *h, kvp_t kvp) {
 }
 
 void enlarge(hashset *h) {
-  size_t new_size = next_size(h->capacity);
-  hashset newset = *h;
-  mk_hashset(&newset, h->hashfunc, h->cmpfunc, new_size);
-  for (size_t i = 0; i < h->capacity; i++) {
-    if (h->used[i]) {
-      hash_insert(&newset, (kvp_t) { .key = h->keys[i], .value = h->values[i] });
+  size_t new_size = next_size(is_inline(h) ? HASHSET_INLINE_CAPACITY : h->capacity);
+  hashset newset = { .hashfunc = h->hashfunc, .cmpfunc = h->cmpfunc, .string_keys = h->string_keys };
+  alloc_slots(&newset, new_size);
+  if (is_inline(h)) {
+    for (size_t i = 0; i < h->count; i++)
+      hash_insert(&newset, h->inline_kvps[i]);
+  } else {
+    for (size_t i = 0; i < h->capacity; i++) {
+      if (h->used[i]) {
+        hash_insert(&newset, (kvp_t) { .key = h->keys[i], .value = h->values[i] });
+      }
     }
   }
   destroy_hashset(h);
@@ -198,7 +328,19 @@ void enlarge(hashset *h) {
 }
 
 bool hashset_add(hashset *h, const kvp_t kvp) {
-  float fullness = h->capacity ? (float)h->count / h->capacity : 1;
+  if (is_inline(h)) {
+    if (inline_find(h, kvp.key, NULL))
+      return false;
+    if (h->count < HASHSET_INLINE_CAPACITY) {
+      h->inline_kvps[h->count++] = kvp;
+      return true;
+    }
+    // Outgrew the inline storage; switch to the hashed layout
+    enlarge(h);
+    return hash_insert(h, kvp);
+  }
+
+  float fullness = (float)h->count / h->capacity;
 
   // Enlarge keys / values if we exceed the specified threshold
   if (fullness > RESIZE_THRESHOLD || h->count == h->capacity) {
@@ -209,6 +351,15 @@ bool hashset_add(hashset *h, const kvp_t kvp) {
 
 bool hashset_remove(hashset *h, const hashset_key key, hashset_value *removed) {
   size_t slot;
+  if (is_inline(h)) {
+    if (!inline_find(h, key, &slot))
+      return false;
+    if (removed)
+      *removed = h->inline_kvps[slot].value;
+    // Keep the inline entries packed by moving the last one into the hole
+    h->inline_kvps[slot] = h->inline_kvps[--h->count];
+    return true;
+  }
   if (!hashset_contains_key(h, key, &slot))
     return false;
   if (removed)
@@ -231,9 +382,20 @@ bool hashset_remove(hashset *h, const hashset_key key, hashset_value *removed) {
 
 bool hashset_set(hashset *h, const kvp_t kvp, hashset_value *removed) {
   size_t index;
+  if (is_inline(h)) {
+    if (inline_find(h, kvp.key, &index)) {
+      if (removed)
+        *removed = h->inline_kvps[index].value;
+      h->inline_kvps[index] = kvp;
+      return true;
+    }
+    return hashset_add(h, kvp);
+  }
   if (hashset_contains_key(h, kvp.key, &index)) {
     if (removed)
       *removed = h->values[index];
+    if (h->strkeys)
+      h->strkeys[index] = hashset_mk_strkey(kvp.key.string);
     h->keys[index] = kvp.key;
     h->values[index] = kvp.value;
     return true;
@@ -242,7 +404,200 @@ bool hashset_set(hashset *h, const kvp_t kvp, hashset_value *removed) {
   }
 }
 
+// Smallest prime capacity which holds n kvps without exceeding RESIZE_THRESHOLD
+size_t build_size(size_t n) {
+  size_t p = (size_t)(n / RESIZE_THRESHOLD) + 1;
+  for (p |= 1; !is_prime(p); p += 2);
+  return p;
+}
+
+// Probe at most `limit` slots starting at `home`.
+// Returns 1 if the kvp was added, 0 if its key was already present, and -1 if no free slot was found.
+// Does not update h->count, so several threads can fill disjoint ranges of slots at once.
+int build_insert(hashset *h, kvp_t kvp, size_t home, size_t limit, hashset_duplicates duplicates) {
+  size_t slot = home;
+  hashset_strkey packed = { .words = { 0, 0 } };
+  if (h->strkeys)
+    packed = hashset_mk_strkey(kvp.key.string);
+  for (size_t probed = 0; probed < limit; probed++, slot = next_slot(slot)) {
+    if (!h->used[slot]) {
+      h->used[slot] = 1;
+      if (h->strkeys)
+        h->strkeys[slot] = packed;
+      h->keys[slot] = kvp.key;
+      h->values[slot] = kvp.value;
+      return 1;
+    }
+    if (slot_equal(h, slot, kvp.key, packed)) {
+      if (duplicates == HASHSET_KEEP_LAST) {
+        if (h->strkeys)
+          h->strkeys[slot] = packed;
+        h->keys[slot] = kvp.key;
+        h->values[slot] = kvp.value;
+      }
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// The slots are split into one partition per thread, and each thread fills the slots of its own partition.
+// kvps are grouped by the partition of their home slot, keeping their input order within each partition.
+// A kvp which would probe past the end of its partition is deferred and inserted after all threads finish.
+typedef struct {
+  hashset *h;
+  const kvp_t *kvps;
+  size_t n;
+  hashset_duplicates duplicates;
+  int threads;
+  size_t part_size;   // Number of slots in each partition
+  size_t *homes;      // Home slot of each kvp
+  size_t *order;      // kvp indices grouped by partition
+  size_t *cursors;    // threads * threads: kvps counted, then write positions, of each input chunk in each partition
+  size_t *parts;      // threads + 1: start of each partition in order
+  size_t *deferred;   // Number of kvps deferred by each partition, stored at the start of the partition in order
+  size_t *added;      // Number of kvps added by each partition
+} build_state;
+
+typedef struct {
+  build_state *s;
+  int id;
+  void (*phase)(build_state *s, int id);
+} build_task;
+
+#define chunk_start(s, id) ((s)->n * (id) / (s)->threads)
+#define partition(s, slot) ((slot) / (s)->part_size)
+
+void build_hash(build_state *s, int id) {
+  size_t *counts = s->cursors + (size_t)id * s->threads;
+  for (size_t i = chunk_start(s, id); i < chunk_start(s, id + 1); i++) {
+    s->homes[i] = s->h->hashfunc(s->kvps[i].key) % s->h->capacity;
+    counts[partition(s, s->homes[i])]++;
+  }
+}
+
+void build_scatter(build_state *s, int id) {
+  size_t *cursors = s->cursors + (size_t)id * s->threads;
+  for (size_t i = chunk_start(s, id); i < chunk_start(s, id + 1); i++)
+    s->order[cursors[partition(s, s->homes[i])]++] = i;
+}
+
+void build_fill(build_state *s, int id) {
+  hashset *h = s->h;
+  size_t end = s->part_size * (id + 1);
+  if (end > h->capacity)
+    end = h->capacity;
+  for (size_t j = s->parts[id]; j < s->parts[id + 1]; j++) {
+    size_t i = s->order[j];
+    switch (build_insert(h, s->kvps[i], s->homes[i], end - s->homes[i], s->duplicates)) {
+      case 1: s->added[id]++; break;
+      case -1: s->order[s->parts[id] + s->deferred[id]++] = i; break;
+    }
+  }
+}
+
+void *build_run(void *arg) {
+  build_task *task = arg;
+  task->phase(task->s, task->id);
+  return NULL;
+}
+
+// Run a phase on every thread id and wait for all of them to finish
+void build_phase(build_state *s, void (*phase)(build_state *s, int id)) {
+  build_task tasks[s->threads];
+  pthread_t handles[s->threads];
+  bool started[s->threads];
+  for (int id = 1; id < s->threads; id++) {
+    tasks[id] = (build_task) { .s = s, .id = id, .phase = phase };
+    started[id] = pthread_create(&handles[id], NULL, build_run, &tasks[id]) == 0;
+  }
+  phase(s, 0);
+  for (int id = 1; id < s->threads; id++) {
+    if (started[id])
+      pthread_join(handles[id], NULL);
+    else // could not start a thread; run its share here instead
+      phase(s, id);
+  }
+}
+
+size_t hashset_build(hashset *h, const kvp_t *kvps, size_t n, hashset_duplicates duplicates, int threads) {
+  size_t count = h->count;
+  if (h->count || n <= HASHSET_INLINE_CAPACITY) {
+    for (size_t i = 0; i < n; i++) {
+      if (duplicates == HASHSET_KEEP_LAST)
+        hashset_set(h, kvps[i], NULL);
+      else
+        hashset_add(h, kvps[i]);
+    }
+    return h->count - count;
+  }
+
+  hashset built = { .hashfunc = h->hashfunc, .cmpfunc = h->cmpfunc, .string_keys = h->string_keys };
+  alloc_slots(&built, build_size(n));
+  destroy_hashset(h);
+  *h = built;
+
+  if (threads <= 0)
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if ((size_t)threads > n / HASHSET_BUILD_GRAIN)
+    threads = n / HASHSET_BUILD_GRAIN;
+  if (threads < 1)
+    threads = 1;
+
+  build_state s = {
+    .h = h, .kvps = kvps, .n = n, .duplicates = duplicates, .threads = threads,
+    .part_size = (h->capacity + threads - 1) / threads,
+    .homes = malloc(n * sizeof(size_t)),
+    .order = malloc(n * sizeof(size_t)),
+    .cursors = calloc((size_t)threads * threads, sizeof(size_t)),
+    .parts = calloc(threads + 1, sizeof(size_t)),
+    .deferred = calloc(threads, sizeof(size_t)),
+    .added = calloc(threads, sizeof(size_t)),
+  };
+
+  build_phase(&s, build_hash);
+
+  // Turn the per chunk counts into write positions. Chunks are laid out in input order within each partition.
+  size_t position = 0;
+  for (int p = 0; p < threads; p++) {
+    s.parts[p] = position;
+    for (int id = 0; id < threads; id++) {
+      size_t chunk_count = s.cursors[(size_t)id * threads + p];
+      s.cursors[(size_t)id * threads + p] = position;
+      position += chunk_count;
+    }
+  }
+  s.parts[threads] = n;
+
+  build_phase(&s, build_scatter);
+  build_phase(&s, build_fill);
+
+  for (int p = 0; p < threads; p++)
+    h->count += s.added[p];
+  // Earlier occurrences of a deferred key were deferred as well, so duplicates are still resolved in input order
+  for (int p = 0; p < threads; p++) {
+    for (size_t j = s.parts[p]; j < s.parts[p] + s.deferred[p]; j++) {
+      size_t i = s.order[j];
+      if (build_insert(h, kvps[i], s.homes[i], h->capacity, duplicates) == 1)
+        h->count++;
+    }
+  }
+
+  free(s.homes);
+  free(s.order);
+  free(s.cursors);
+  free(s.parts);
+  free(s.deferred);
+  free(s.added);
+  return h->count;
+}
+
 void hashset_print(hashset *h, formatfunc f) {
+  if (is_inline(h)) {
+    for (size_t i = 0; i < h->count; i++)
+      printf("%3zu: %s\n", i, f(h->inline_kvps[i]));
+    return;
+  }
   for (size_t i = 0; i < h->capacity; i++) {
     if (h->used[i]) {
       printf("%3zu: %s\n", i, f((kvp_t) { .key = h->keys[i], .value = h->values[i] }));
@@ -1,5 +1,6 @@
 // I was trying some stuff out
-// Current implementation is slightly broken
+// Chains start at a sentinel bucket in the table; removed buckets are kept and reused by later inserts
+// Each hashset has its own arena of buckets, which are relinked on resize and freed with the hashset
 // Linked lists for collissions are okay, but not better than linear probing with a good hash function it seems
 // Both implementations are equally readable
 // First attempt I used malloc for buckets, then I switched to an incremental allocator (arena)
@@ -53,7 +54,9 @@ typedef struct {
   size_t capacity;
   hashfunc_t hashfunc;
   cmpfunc_t cmpfunc;
-  hashset_bucket *buckets;
+  hashset_bucket *buckets;  // The first bucket of each chain is a sentinel which holds no kvp
+  hashset_bucket *unused;   // Removed buckets, reused by later inserts
+  arena *arena;             // Every bucket outside the table, made on the first insert
 } hashset;
 
 // Returns true if hashset contains the specified key
@@ -103,12 +106,11 @@ size_t hash_pointer(hashset_key key) {
   return hash(key.integer / 8);
 }
 
-static void* aalloc(size_t nmemb, size_t mem_size) {
-  static arena *allocator = NULL;
-  if (!allocator) {
-    allocator = mk_arena();
+static void* aalloc(hashset *h, size_t nmemb, size_t mem_size) {
+  if (!h->arena) {
+    h->arena = mk_arena();
   }
-  char *mem = arena_alloc(allocator, nmemb, mem_size);
+  char *mem = arena_alloc(h->arena, nmemb, mem_size);
   return mem;
 }
 
@@ -156,11 +158,15 @@ void mk_hashset(hashset *h, hashfunc_t hashfunc, cmpfunc_t cmpfunc, size_t sz) {
   h->hashfunc = hashfunc;
   h->cmpfunc = cmpfunc ? cmpfunc : default_equality;
   if (sz) {
-    h->buckets = aalloc(sz, sizeof(hashset_bucket));
+    h->buckets = calloc(sz, sizeof(hashset_bucket));
   }
 }
 
 void destroy_hashset(hashset *h) {
+  free(h->buckets);
+  if (h->arena)
+    destroy_arena(h->arena);
+  *h = (hashset) { 0 };
 }
 
 #define next_slot(slot) (((slot) + 1) % h->capacity)
@@ -168,7 +174,7 @@ void destroy_hashset(hashset *h) {
 bool hashset_contains_key(const hashset *h, const hashset_key key, hashset_bucket **bucket) {
   hashset_bucket *b;
   if (h->count == 0) return false;
-  b = &h->buckets[h->hashfunc(key) % h->capacity];
+  b = h->buckets[h->hashfunc(key) % h->capacity].next;
 
   for (; b; b = b->next)
     if (h->cmpfunc(b->key, key) == 0) {
@@ -195,11 +201,16 @@ bool hash_insert(hashset *h, kvp_t kvp) {
   slot = h->hashfunc(kvp.key) % h->capacity;
   current = &h->buckets[slot];
 
-  for (; current; current = current->next)
-    if (h->cmpfunc(current->key, kvp.key) == 0)
+  for (; current->next; current = current->next)
+    if (h->cmpfunc(current->next->key, kvp.key) == 0)
       return false;
 
-  next = aalloc(sizeof(hashset_bucket), 1);
+  if (h->unused) {
+    next = h->unused;
+    h->unused = next->next;
+  } else {
+    next = aalloc(h, sizeof(hashset_bucket), 1);
+  }
   next->key = kvp.key;
   next->value = kvp.value;
   next->next = NULL;
@@ -209,17 +220,21 @@ bool hash_insert(hashset *h, kvp_t kvp) {
   return true;
 }
 
+// Move every bucket to the front of its chain in a larger table; the keys are already unique
 void enlarge(hashset *h) {
   size_t new_size = next_size(h->capacity);
-  hashset newset = *h;
-  hashset_bucket *b;
+  hashset_bucket *table = calloc(new_size, sizeof(hashset_bucket)), *b, *next;
 
-  mk_hashset(&newset, h->hashfunc, h->cmpfunc, new_size);
   for (size_t i = 0; i < h->capacity; i++)
-    for (b = &h->buckets[i]; b; b = b->next)
-      hash_insert(&newset, (kvp_t) { .key = b->key, .value = b->value });
-  destroy_hashset(h);
-  *h = newset;
+    for (b = h->buckets[i].next; b; b = next) {
+      hashset_bucket *head = &table[h->hashfunc(b->key) % new_size];
+      next = b->next;
+      b->next = head->next;
+      head->next = b;
+    }
+  free(h->buckets);
+  h->buckets = table;
+  h->capacity = new_size;
 }
 
 bool hashset_add(hashset *h, const kvp_t kvp) {
@@ -239,8 +254,8 @@ bool hashset_remove(hashset *h, const hashset_key key, hashset_value *removed) {
   size_t slot;
   hashset_bucket *b, *prev;
   slot = h->hashfunc(key) % h->capacity;
-  b = &h->buckets[slot];
-  prev = NULL;
+  prev = &h->buckets[slot];
+  b = prev->next;
 
   for (; b; prev = b, b = b->next)
     if (h->cmpfunc(b->key, key) == 0)
@@ -249,11 +264,9 @@ bool hashset_remove(hashset *h, const hashset_key key, hashset_value *removed) {
   if (b) {
     if (removed)
       *removed = b->value;
-    if (prev) {
-      prev->next = b->next;
-    } else {
-      h->buckets[slot] = *b->next;
-    }
+    prev->next = b->next;
+    b->next = h->unused;
+    h->unused = b;
     h->count--;
     return true;
   }
@@ -1,7 +1,10 @@
 #include "hashset.h"
+#define BENCHMARK_ALLOCATIONS
 #include "../benchmark/benchmark.h"
 #include <stdio.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 
 #define LENGTH(X) (sizeof(X) / sizeof(X[0]))
@@ -100,12 +103,22 @@ do {
 while (0); 
 
 
-int test_hashset(i64 start, i64 end, i64 increment, hashfunc_t fn) {
+// The benchmarks share these arguments; setup_hashset makes the hashset, and teardown_hashset destroys it
+void setup_hashset(hashset *h, i64 start, i64 end, i64 increment, hashfunc_t fn) {
+  (void)start, (void)end, (void)increment;
+  mk_hashset(h, fn, NULL, 0);
+}
+
+void teardown_hashset(hashset *h, i64 start, i64 end, i64 increment, hashfunc_t fn) {
+  (void)start, (void)end, (void)increment, (void)fn;
+  destroy_hashset(h);
+}
+
+// Add and read back every key, then remove them all, ten times over. The hashset is empty afterwards.
+int test_hashset(hashset *h, i64 start, i64 end, i64 increment, hashfunc_t fn) {
   int res = 1;
   i64 count = (end - start - 1) / increment + 1;
-  hashset h2;
-  mk_hashset(&h2, fn, NULL, 0);
-  hashset *h = &h2;
+  (void)fn;
   for (int n = 0; n < 10; n++) {
     for (i64 i = start; i < end; i += increment) {
       hashset_key key = { .integer = i };
@@ -158,10 +171,211 @@ int test_hashset(i64 start, i64 end, i64 increment, hashfunc_t fn) {
     }
   }
 end:
-  destroy_hashset(h);
   return res;
 }
 
+void setup_filled_hashset(hashset *h, i64 start, i64 end, i64 increment, hashfunc_t fn) {
+  mk_hashset(h, fn, NULL, 0);
+  for (i64 i = start; i < end; i += increment)
+    hashset_add(h, (kvp_t) { .key = { .integer = i }, .value = { .integer = i } });
+}
+
+// Look up the next key of a filled hashset
+i64 get_next(hashset *h, i64 start, i64 end, i64 increment, hashfunc_t fn) {
+  static i64 i;
+  hashset_value value = {0};
+  (void)fn;
+  i = i >= start && i + increment < end ? i + increment : start;
+  hashset_get(h, (hashset_key) { .integer = i }, &value);
+  return value.integer;
+}
+
+// Grow a hashset past HASHSET_INLINE_CAPACITY and shrink it back, checking every entry along the way
+int test_inline_hashset() {
+  int res = 1;
+  hashset h;
+  i64 n = HASHSET_INLINE_CAPACITY * 4;
+  mk_hashset(&h, hash_integer, NULL, 0);
+  for (i64 i = 0; i < n; i++) {
+    if (!hashset_add(&h, (kvp_t) { .key = { .integer = i }, .value = { .integer = i + 1 } })) {
+      printf("Failed to add %lld\n", i);
+      res = 0;
+      goto end;
+    }
+    if (hashset_add(&h, (kvp_t) { .key = { .integer = i }, .value = { .integer = i + 1 } })) {
+      printf("Added duplicate %lld\n", i);
+      res = 0;
+      goto end;
+    }
+    for (i64 j = 0; j <= i; j++) {
+      hashset_value value;
+      if (!hashset_get(&h, (hashset_key) { .integer = j }, &value) || value.integer != j + 1) {
+        printf("Failed to get %lld with %lld elements\n", j, i + 1);
+        res = 0;
+        goto end;
+      }
+    }
+  }
+  destroy_hashset(&h);
+
+  mk_hashset(&h, hash_integer, NULL, 0);
+  for (i64 i = 0; i < HASHSET_INLINE_CAPACITY; i++)
+    hashset_add(&h, (kvp_t) { .key = { .integer = i }, .value = { .integer = i } });
+  if (h.used != NULL) {
+    printf("Expected %d elements to be stored inline\n", HASHSET_INLINE_CAPACITY);
+    res = 0;
+    goto end;
+  }
+  for (i64 i = 0; i < HASHSET_INLINE_CAPACITY; i += 2) {
+    hashset_value removed;
+    if (!hashset_remove(&h, (hashset_key) { .integer = i }, &removed) || removed.integer != i) {
+      printf("Failed to remove %lld\n", i);
+      res = 0;
+      goto end;
+    }
+  }
+  for (i64 i = 0; i < HASHSET_INLINE_CAPACITY; i++) {
+    hashset_value value;
+    if (hashset_get(&h, (hashset_key) { .integer = i }, &value) != (i % 2 == 1)) {
+      printf("Unexpected membership of %lld after remove\n", i);
+      res = 0;
+      goto end;
+    }
+  }
+end:
+  destroy_hashset(&h);
+  return res;
+}
+
+// Keys around the inline length and long keys sharing a prefix, looked up through copies of the strings
+int test_string_keys() {
+  int res = 1;
+  hashset h;
+  char keys[64][40];
+  char lookup[40];
+  mk_string_hashset(&h, 0);
+  for (int i = 0; i < 64; i++) {
+    int len = i % 32;
+    memset(keys[i], 'k', len);
+    snprintf(keys[i] + len, sizeof(keys[i]) - len, "%d", i);
+    if (!hashset_add(&h, (kvp_t) { .key = { .string = keys[i] }, .value = { .integer = i } })) {
+      printf("Failed to add %s\n", keys[i]);
+      res = 0;
+      goto end;
+    }
+  }
+  for (int i = 0; i < 64; i++) {
+    hashset_value value;
+    strcpy(lookup, keys[i]);
+    if (!hashset_get(&h, (hashset_key) { .string = lookup }, &value) || value.integer != (i64)i) {
+      printf("Failed to get %s\n", lookup);
+      res = 0;
+      goto end;
+    }
+    if (hashset_add(&h, (kvp_t) { .key = { .string = lookup }, .value = { .integer = 0 } })) {
+      printf("Added duplicate %s\n", lookup);
+      res = 0;
+      goto end;
+    }
+    lookup[strlen(lookup) - 1] = '!';
+    if (hashset_get(&h, (hashset_key) { .string = lookup }, &value)) {
+      printf("Unexpectedly found %s\n", lookup);
+      res = 0;
+      goto end;
+    }
+  }
+  for (int i = 0; i < 64; i += 2) {
+    hashset_value removed;
+    strcpy(lookup, keys[i]);
+    if (!hashset_remove(&h, (hashset_key) { .string = lookup }, &removed) || removed.integer != (i64)i) {
+      printf("Failed to remove %s\n", lookup);
+      res = 0;
+      goto end;
+    }
+  }
+  if (h.count != 32) {
+    printf("Expected 32 elements, got %zu\n", h.count);
+    res = 0;
+  }
+end:
+  destroy_hashset(&h);
+  return res;
+}
+
+// Build hashsets from an array with duplicate keys, and compare them against hashsets filled one kvp at a time
+int test_build(hashfunc_t fn, hashset_duplicates duplicates, int threads) {
+  int res = 1;
+  size_t n = 200000;
+  kvp_t *kvps = malloc(n * sizeof(kvp_t));
+  hashset built, expected;
+  for (size_t i = 0; i < n; i++)
+    kvps[i] = (kvp_t) { .key = { .integer = (i * 7) % (n / 2) }, .value = { .integer = i } };
+  mk_hashset(&built, fn, NULL, 0);
+  mk_hashset(&expected, fn, NULL, 0);
+  for (size_t i = 0; i < n; i++) {
+    if (duplicates == HASHSET_KEEP_LAST)
+      hashset_set(&expected, kvps[i], NULL);
+    else
+      hashset_add(&expected, kvps[i]);
+  }
+  if (hashset_build(&built, kvps, n, duplicates, threads) != expected.count || built.count != expected.count) {
+    printf("Expected %zu elements, got %zu\n", expected.count, built.count);
+    res = 0;
+    goto end;
+  }
+  for (size_t i = 0; i < n; i++) {
+    hashset_value want, got;
+    hashset_get(&expected, kvps[i].key, &want);
+    if (!hashset_get(&built, kvps[i].key, &got) || got.integer != want.integer) {
+      printf("Expected %lld => %lld, got %lld\n", kvps[i].key.integer, want.integer, got.integer);
+      res = 0;
+      goto end;
+    }
+  }
+end:
+  destroy_hashset(&built);
+  destroy_hashset(&expected);
+  free(kvps);
+  return res;
+}
+
+// Growing a hashset reallocates its table a logarithmic number of times, lookups allocate nothing,
+// and destroying it frees every block
+int test_allocations(hashfunc_t fn) {
+  hashset h;
+  hashset_value value;
+  size_t n = 1000000;
+  bench_allocs_reset();
+  bench_allocs_start();
+  mk_hashset(&h, fn, NULL, 0);
+  for (size_t i = 0; i < n; i++)
+    hashset_add(&h, (kvp_t) { .key = { .integer = i }, .value = { .integer = i } });
+  bench_allocs_stop();
+  bench_allocs_t grown = bench_allocs;
+  LOG("%zu inserts: %llu allocations, %llu frees, %llu bytes\n", n, (unsigned long long)grown.allocations,
+      (unsigned long long)grown.frees, (unsigned long long)grown.bytes);
+  bench_allocs_start();
+  for (size_t i = 0; i < n; i++)
+    hashset_get(&h, (hashset_key) { .integer = i }, &value);
+  bench_allocs_stop();
+  if (bench_allocs.allocations != grown.allocations) {
+    printf("Lookups allocated %llu blocks\n", (unsigned long long)(bench_allocs.allocations - grown.allocations));
+    return 0;
+  }
+  if (grown.allocations > 4 * 64) {
+    printf("Expected a logarithmic number of allocations, got %llu\n", (unsigned long long)grown.allocations);
+    return 0;
+  }
+  bench_allocs_start();
+  destroy_hashset(&h);
+  bench_allocs_stop();
+  if (bench_allocs.frees != bench_allocs.allocations) {
+    printf("Leaked %llu blocks\n", (unsigned long long)(bench_allocs.allocations - bench_allocs.frees));
+    return 0;
+  }
+  return 1;
+}
+
 size_t bad(hashset_key key) {
   return key.integer;
 }
@@ -178,9 +392,20 @@ int main(void) {
   i64 start = 169;
   i64 end = 123456;
   i64 increment = 7;
-  benchmark(test_hashset, start, end, increment, bad);
-  benchmark(test_hashset, start, end, increment, ideal);
-  benchmark(test_hashset, start, end, increment, generic);
+  if (!test_inline_hashset() || !test_string_keys() || !test_allocations(generic))
+    return 1;
+  if (!test_build(generic, HASHSET_KEEP_FIRST, 4) || !test_build(generic, HASHSET_KEEP_LAST, 4) ||
+      !test_build(bad, HASHSET_KEEP_FIRST, 7) || !test_build(bad, HASHSET_KEEP_LAST, 1))
+    return 1;
+  hashset h;
+  setup_hashset(&h, start, end, increment, generic);
+  if (!test_hashset(&h, start, end, increment, generic))
+    return 1;
+  teardown_hashset(&h, start, end, increment, generic);
+  benchmark_fixture(setup_hashset, teardown_hashset, test_hashset, &h, start, end, increment, bad);
+  benchmark_fixture(setup_hashset, teardown_hashset, test_hashset, &h, start, end, increment, ideal);
+  benchmark_fixture(setup_hashset, teardown_hashset, test_hashset, &h, start, end, increment, generic);
+  benchmark_setup(setup_filled_hashset, teardown_hashset, get_next, &h, start, end, increment, generic);
   // TIME(test_hashset(999, 9999999));
-  return 0;
+  return bench_regressions != 0;
 }
@@ -0,0 +1,458 @@
+#ifndef __ART_H
+#define __ART_H
+
+// Adaptive radix tree over byte-string keys. Each inner node branches on one byte of the key and
+// grows through four sizes (4, 16, 48 and 256 children) as children are added, and a chain of
+// nodes with one child each is compressed into a prefix stored in the node below it. A lookup
+// visits at most one node per key byte and compares the key once at the end. Keys are kept in
+// lexicographic byte order, with a key sorting before every key it is a prefix of.
+//
+// Nodes and copies of the keys are allocated from an arena owned by the tree.
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "../arena/arena.h"
+
+// Number of prefix bytes stored in a node. Longer prefixes are checked against a leaf.
+#define ART_MAX_PREFIX 8
+
+enum { ART_NODE4, ART_NODE16, ART_NODE48, ART_NODE256 };
+
+typedef struct {
+  void *value;
+  size_t len;
+  unsigned char key[];
+} art_leaf;
+
+// Children are inner nodes, or leaves tagged by setting the lowest bit of the pointer
+typedef struct art_node art_node;
+struct art_node {
+  uint8_t type;
+  uint16_t count;                        // Number of children
+  uint32_t prefix_len;                   // Length of the compressed path above the children
+  unsigned char prefix[ART_MAX_PREFIX];  // The first bytes of the compressed path
+  art_leaf *end;                         // The key which ends at this node, if any
+};
+
+typedef struct { art_node n; unsigned char keys[4]; art_node *children[4]; } art_node4;
+typedef struct { art_node n; unsigned char keys[16]; art_node *children[16]; } art_node16;
+typedef struct { art_node n; unsigned char index[256]; art_node *children[48]; } art_node48;  // index holds slot + 1
+typedef struct { art_node n; art_node *children[256]; } art_node256;
+
+typedef struct {
+  arena *arena;
+  art_node *root;
+  size_t count;
+  art_node *unused[4]; // Nodes which were replaced by a larger node, for reuse
+} art_tree;
+
+// Called for each key in order. Return nonzero to stop the iteration.
+typedef int (*art_callback)(void *data, const unsigned char *key, size_t len, void *value);
+
+// Make a new, empty tree. Returns false if the arena could not be created.
+bool mk_art(art_tree *t);
+// Free every node and key of the tree. Values are not freed.
+void destroy_art(art_tree *t);
+// Insert a copy of the key if it is not already in the tree, returning true if it was inserted
+bool art_insert(art_tree *t, const void *key, size_t len, void *value);
+// Return true if the key is in the tree, returning its value in *value
+bool art_find(const art_tree *t, const void *key, size_t len, void **value);
+// Call cb for every key in order, returning the first nonzero result of cb
+int art_iterate(const art_tree *t, art_callback cb, void *data);
+// Call cb in order for every key which starts with prefix, returning the first nonzero result of cb
+int art_iterate_prefix(const art_tree *t, const void *prefix, size_t len, art_callback cb, void *data);
+
+#endif // __ART_H
+
+#ifdef ART_IMPLEMENTATION
+#undef ART_IMPLEMENTATION
+
+#include <string.h>
+#define ARENA_IMPLEMENTATION
+#include "../arena/arena.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ART_X86
+#include <emmintrin.h>
+#endif
+
+#define is_leaf(n) ((uintptr_t)(n) & 1)
+#define as_leaf(n) ((art_leaf*)((uintptr_t)(n) - 1))
+#define tag_leaf(l) ((art_node*)((uintptr_t)(l) + 1))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+static const size_t node_sizes[] = { sizeof(art_node4), sizeof(art_node16), sizeof(art_node48), sizeof(art_node256) };
+
+// Round arena allocations up to keep them pointer aligned
+static void *art_alloc(art_tree *t, size_t size) {
+  return arena_alloc(t->arena, (size + 7) / 8, 8);
+}
+
+bool mk_art(art_tree *t) {
+  *t = (art_tree) { .arena = mk_arena() };
+  return t->arena != NULL;
+}
+
+void destroy_art(art_tree *t) {
+  destroy_arena(t->arena);
+  *t = (art_tree) {0};
+}
+
+static art_node *art_mk_node(art_tree *t, uint8_t type) {
+  art_node *n = t->unused[type];
+  if (n)
+    t->unused[type] = *(art_node**)n;
+  else
+    n = art_alloc(t, node_sizes[type]);
+  memset(n, 0, node_sizes[type]);
+  n->type = type;
+  return n;
+}
+
+static art_leaf *mk_leaf(art_tree *t, const unsigned char *key, size_t len, void *value) {
+  art_leaf *l = art_alloc(t, sizeof(art_leaf) + len);
+  l->value = value;
+  l->len = len;
+  memcpy(l->key, key, len);
+  return l;
+}
+
+static bool leaf_matches(const art_leaf *l, const unsigned char *key, size_t len) {
+  return l->len == len && memcmp(l->key, key, len) == 0;
+}
+
+// Return the slot of the child for the given byte, or NULL
+static art_node **find_child(art_node *n, unsigned char byte) {
+  switch (n->type) {
+  case ART_NODE4: {
+    art_node4 *n4 = (art_node4*)n;
+    for (int i = 0; i < n->count; i++)
+      if (n4->keys[i] == byte)
+        return &n4->children[i];
+    return NULL;
+  }
+  case ART_NODE16: {
+    art_node16 *n16 = (art_node16*)n;
+#ifdef ART_X86
+    __m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8((char)byte), _mm_loadu_si128((const __m128i*)n16->keys));
+    int mask = _mm_movemask_epi8(cmp) & ((1 << n->count) - 1);
+    return mask ? &n16->children[__builtin_ctz(mask)] : NULL;
+#else
+    for (int i = 0; i < n->count; i++)
+      if (n16->keys[i] == byte)
+        return &n16->children[i];
+    return NULL;
+#endif
+  }
+  case ART_NODE48: {
+    art_node48 *n48 = (art_node48*)n;
+    return n48->index[byte] ? &n48->children[n48->index[byte] - 1] : NULL;
+  }
+  default: {
+    art_node256 *n256 = (art_node256*)n;
+    return n256->children[byte] ? &n256->children[byte] : NULL;
+  }
+  }
+}
+
+// Copy the header into a larger node, and put the old node aside for reuse
+static art_node *grow(art_tree *t, art_node *n) {
+  art_node *bigger = art_mk_node(t, n->type + 1);
+  uint8_t type = bigger->type;
+  *bigger = *n;
+  bigger->type = type;
+  switch (n->type) {
+  case ART_NODE4: {
+    art_node4 *from = (art_node4*)n;
+    art_node16 *to = (art_node16*)bigger;
+    memcpy(to->keys, from->keys, n->count);
+    memcpy(to->children, from->children, n->count * sizeof(art_node*));
+    break;
+  }
+  case ART_NODE16: {
+    art_node16 *from = (art_node16*)n;
+    art_node48 *to = (art_node48*)bigger;
+    memcpy(to->children, from->children, n->count * sizeof(art_node*));
+    for (int i = 0; i < n->count; i++)
+      to->index[from->keys[i]] = i + 1;
+    break;
+  }
+  case ART_NODE48: {
+    art_node48 *from = (art_node48*)n;
+    art_node256 *to = (art_node256*)bigger;
+    for (int b = 0; b < 256; b++)
+      if (from->index[b])
+        to->children[b] = from->children[from->index[b] - 1];
+    break;
+  }
+  }
+  *(art_node**)n = t->unused[n->type];
+  t->unused[type - 1] = n;
+  return bigger;
+}
+
+// Add a child for a byte which has none, growing the node stored in *ref if it is full
+static void add_child(art_tree *t, art_node **ref, unsigned char byte, art_node *child) {
+  art_node *n = *ref;
+  static const int capacity[] = { 4, 16, 48, 256 };
+  if (n->count == capacity[n->type])
+    *ref = n = grow(t, n);
+  switch (n->type) {
+  case ART_NODE4:
+  case ART_NODE16: {
+    // keys are kept sorted for ordered iteration
+    unsigned char *keys = n->type == ART_NODE4 ? ((art_node4*)n)->keys : ((art_node16*)n)->keys;
+    art_node **children = n->type == ART_NODE4 ? ((art_node4*)n)->children : ((art_node16*)n)->children;
+    int i = 0;
+    while (i < n->count && keys[i] < byte)
+      i++;
+    memmove(keys + i + 1, keys + i, n->count - i);
+    memmove(children + i + 1, children + i, (n->count - i) * sizeof(art_node*));
+    keys[i] = byte;
+    children[i] = child;
+    break;
+  }
+  case ART_NODE48: {
+    art_node48 *n48 = (art_node48*)n;
+    // children are never removed, so the slots in use are the first count
+    n48->children[n->count] = child;
+    n48->index[byte] = n->count + 1;
+    break;
+  }
+  default:
+    ((art_node256*)n)->children[byte] = child;
+  }
+  n->count++;
+}
+
+// The leaf with the smallest key below n
+static art_leaf *art_minimum(art_node *n) {
+  while (!is_leaf(n)) {
+    if (n->end)
+      return n->end;
+    switch (n->type) {
+    case ART_NODE4: n = ((art_node4*)n)->children[0]; break;
+    case ART_NODE16: n = ((art_node16*)n)->children[0]; break;
+    case ART_NODE48: {
+      art_node48 *n48 = (art_node48*)n;
+      int b = 0;
+      while (!n48->index[b])
+        b++;
+      n = n48->children[n48->index[b] - 1];
+      break;
+    }
+    default: {
+      art_node256 *n256 = (art_node256*)n;
+      int b = 0;
+      while (!n256->children[b])
+        b++;
+      n = n256->children[b];
+    }
+    }
+  }
+  return as_leaf(n);
+}
+
+// Number of bytes of the prefix of n which match the key at depth. The key may end first.
+static uint32_t prefix_mismatch(art_node *n, const unsigned char *key, size_t len, size_t depth) {
+  uint32_t i = 0, stored = min(n->prefix_len, ART_MAX_PREFIX);
+  for (; i < stored; i++)
+    if (depth + i >= len || n->prefix[i] != key[depth + i])
+      return i;
+  if (n->prefix_len > ART_MAX_PREFIX) {
+    // every key below n shares the prefix, so any leaf has the bytes which are not stored
+    art_leaf *l = art_minimum(n);
+    for (; i < n->prefix_len; i++)
+      if (depth + i >= len || l->key[depth + i] != key[depth + i])
+        return i;
+  }
+  return i;
+}
+
+// Make a node4 with the given prefix, holding the key of l, which ends at depth + prefix_len or continues below
+static art_node *mk_split(art_tree *t, const unsigned char *prefix, uint32_t prefix_len, art_leaf *l, size_t depth) {
+  art_node *n = art_mk_node(t, ART_NODE4);
+  n->prefix_len = prefix_len;
+  memcpy(n->prefix, prefix, min(prefix_len, ART_MAX_PREFIX));
+  if (l->len == depth + prefix_len)
+    n->end = l;
+  else
+    add_child(t, &n, l->key[depth + prefix_len], tag_leaf(l));
+  return n;
+}
+
+bool art_insert(art_tree *t, const void *key_, size_t len, void *value) {
+  const unsigned char *key = key_;
+  art_node **ref = &t->root;
+  size_t depth = 0;
+  for (;;) {
+    art_node *n = *ref;
+    if (!n) {
+      *ref = tag_leaf(mk_leaf(t, key, len, value));
+      break;
+    }
+
+    if (is_leaf(n)) {
+      // replace the leaf with a node branching where the two keys differ
+      art_leaf *l = as_leaf(n);
+      uint32_t p = 0;
+      if (leaf_matches(l, key, len))
+        return false;
+      while (depth + p < l->len && depth + p < len && l->key[depth + p] == key[depth + p])
+        p++;
+      art_node *split = mk_split(t, key + depth, p, l, depth);
+      art_leaf *new = mk_leaf(t, key, len, value);
+      if (len == depth + p)
+        split->end = new;
+      else
+        add_child(t, &split, key[depth + p], tag_leaf(new));
+      *ref = split;
+      break;
+    }
+
+    uint32_t p = prefix_mismatch(n, key, len, depth);
+    if (p < n->prefix_len) {
+      // the key leaves the compressed path; split it at the first differing byte
+      art_node *split = art_mk_node(t, ART_NODE4);
+      unsigned char byte;
+      split->prefix_len = p;
+      memcpy(split->prefix, n->prefix, min(p, ART_MAX_PREFIX));
+      if (n->prefix_len <= ART_MAX_PREFIX) {
+        byte = n->prefix[p];
+        n->prefix_len -= p + 1;
+        memmove(n->prefix, n->prefix + p + 1, n->prefix_len);
+      } else {
+        art_leaf *l = art_minimum(n);
+        byte = l->key[depth + p];
+        n->prefix_len -= p + 1;
+        memcpy(n->prefix, l->key + depth + p + 1, min(n->prefix_len, ART_MAX_PREFIX));
+      }
+      add_child(t, &split, byte, n);
+      art_leaf *new = mk_leaf(t, key, len, value);
+      if (len == depth + p)
+        split->end = new;
+      else
+        add_child(t, &split, key[depth + p], tag_leaf(new));
+      *ref = split;
+      break;
+    }
+    depth += n->prefix_len;
+
+    if (depth == len) {
+      if (n->end)
+        return false;
+      n->end = mk_leaf(t, key, len, value);
+      break;
+    }
+    art_node **child = find_child(n, key[depth]);
+    if (!child) {
+      add_child(t, ref, key[depth], tag_leaf(mk_leaf(t, key, len, value)));
+      break;
+    }
+    ref = child;
+    depth++;
+  }
+  t->count++;
+  return true;
+}
+
+bool art_find(const art_tree *t, const void *key_, size_t len, void **value) {
+  const unsigned char *key = key_;
+  art_node *n = t->root;
+  art_leaf *l = NULL;
+  size_t depth = 0;
+  // Only the stored prefix bytes are compared on the way down; the leaf is compared in full
+  while (n) {
+    if (is_leaf(n)) {
+      l = as_leaf(n);
+      break;
+    }
+    uint32_t stored = min(n->prefix_len, ART_MAX_PREFIX);
+    for (uint32_t i = 0; i < stored; i++)
+      if (depth + i >= len || n->prefix[i] != key[depth + i])
+        return false;
+    depth += n->prefix_len;
+    if (depth >= len) {
+      l = depth == len ? n->end : NULL;
+      break;
+    }
+    art_node **child = find_child(n, key[depth]);
+    n = child ? *child : NULL;
+    depth++;
+  }
+  if (!l || !leaf_matches(l, key, len))
+    return false;
+  if (value)
+    *value = l->value;
+  return true;
+}
+
+// The depth is bounded by the length of the longest key
+static int art_walk(art_node *n, art_callback cb, void *data) {
+  int r = 0;
+  if (is_leaf(n)) {
+    art_leaf *l = as_leaf(n);
+    return cb(data, l->key, l->len, l->value);
+  }
+  if (n->end && (r = cb(data, n->end->key, n->end->len, n->end->value)))
+    return r;
+  switch (n->type) {
+  case ART_NODE4:
+    for (int i = 0; i < n->count && !r; i++)
+      r = art_walk(((art_node4*)n)->children[i], cb, data);
+    break;
+  case ART_NODE16:
+    for (int i = 0; i < n->count && !r; i++)
+      r = art_walk(((art_node16*)n)->children[i], cb, data);
+    break;
+  case ART_NODE48: {
+    art_node48 *n48 = (art_node48*)n;
+    for (int b = 0; b < 256 && !r; b++)
+      if (n48->index[b])
+        r = art_walk(n48->children[n48->index[b] - 1], cb, data);
+    break;
+  }
+  default:
+    for (int b = 0; b < 256 && !r; b++)
+      if (((art_node256*)n)->children[b])
+        r = art_walk(((art_node256*)n)->children[b], cb, data);
+  }
+  return r;
+}
+
+int art_iterate(const art_tree *t, art_callback cb, void *data) {
+  return t->root ? art_walk(t->root, cb, data) : 0;
+}
+
+int art_iterate_prefix(const art_tree *t, const void *prefix_, size_t len, art_callback cb, void *data) {
+  const unsigned char *prefix = prefix_;
+  art_node *n = t->root;
+  size_t depth = 0;
+  while (n) {
+    if (is_leaf(n)) {
+      art_leaf *l = as_leaf(n);
+      if (l->len >= len && memcmp(l->key, prefix, len) == 0)
+        return cb(data, l->key, l->len, l->value);
+      return 0;
+    }
+    uint32_t p = prefix_mismatch(n, prefix, len, depth);
+    // every key below n starts with the path to it, so once the prefix is used up they all match
+    if (depth + p == len)
+      return art_walk(n, cb, data);
+    if (p < n->prefix_len)
+      return 0;
+    depth += n->prefix_len;
+    art_node **child = find_child(n, prefix[depth]);
+    n = child ? *child : NULL;
+    depth++;
+  }
+  return 0;
+}
+
+#undef is_leaf
+#undef as_leaf
+#undef tag_leaf
+#undef min
+
+#endif // ART_IMPLEMENTATION
@@ -0,0 +1,73 @@
+#define SKIPLIST_IMPLEMENTATION
+#include "skiplist.h"
+#include "../benchmark/benchmark.h"
+
+// Throughput of a mix of lookups, inserts and deletes from 1 to N threads sharing one list
+//   ./bench_skiplist [threads]
+
+#define KEYS (1 << 20)
+#define MAX_THREADS 256
+
+int compare_int(const void *left, const void *right) {
+  int l = *(const int*)left, r = *(const int*)right;
+  return (l > r) - (l < r);
+}
+
+// One cache line per thread, so the threads do not share the lines of their seeds
+typedef struct {
+  skiplist_handle *handle;
+  unsigned seed;
+  char pad[64 - sizeof(skiplist_handle*) - sizeof(unsigned)];
+} worker_t;
+
+typedef struct {
+  skiplist list;
+  int *keys;
+  worker_t workers[MAX_THREADS];
+} shared_t;
+
+void join_list(void *data, int thread) {
+  shared_t *s = data;
+  s->workers[thread] = (worker_t) { .handle = skiplist_join(&s->list), .seed = thread + 1 };
+}
+
+void leave_list(void *data, int thread) {
+  shared_t *s = data;
+  skiplist_leave(s->workers[thread].handle);
+}
+
+void mixed(void *data, int thread) {
+  shared_t *s = data;
+  worker_t *w = &s->workers[thread];
+  int *key = &s->keys[rand_r(&w->seed) % KEYS];
+  int op = rand_r(&w->seed) % 100;
+  // 90% lookups, 5% inserts and 5% deletes keep the list about half full
+  if (op < 90)
+    skiplist_find(w->handle, key, NULL);
+  else if (op < 95)
+    skiplist_insert(w->handle, key, key);
+  else
+    skiplist_delete(w->handle, key, NULL);
+}
+
+int main(int argc, char **argv) {
+  int max_threads = argc > 1 ? atoi(argv[1]) : 0;
+  shared_t *s = calloc(1, sizeof(shared_t));
+  if (max_threads > MAX_THREADS)
+    max_threads = MAX_THREADS;
+  s->keys = malloc(KEYS * sizeof(int));
+  mk_skiplist(&s->list, compare_int);
+  skiplist_handle *h = skiplist_join(&s->list);
+  for (int i = 0; i < KEYS; i++) {
+    s->keys[i] = i;
+    if (i % 2)
+      skiplist_insert(h, &s->keys[i], &s->keys[i]);
+  }
+  skiplist_leave(h);
+
+  benchmark_threads_fixture(max_threads, join_list, leave_list, mixed, s);
+  destroy_skiplist(&s->list);
+  free(s->keys);
+  free(s);
+  return bench_regressions != 0;
+}
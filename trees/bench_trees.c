@@ -0,0 +1,65 @@
+#define BPTREE_IMPLEMENTATION
+#include "bptree.h"
+#define EYTZINGER_IMPLEMENTATION
+#include "eytzinger.h"
+#include "../benchmark/benchmark.h"
+
+// Lookups of random keys in a sorted set too large for the caches
+static uint64_t state = 88172645463325252ull;
+static int64_t next_key(size_t n) {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return (int64_t)(state % (2 * n));
+}
+
+size_t binary_search(const int64_t *sorted, size_t n) {
+  int64_t key = next_key(n);
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (sorted[mid] < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+size_t eytzinger(const eytzinger_t *e) {
+  return eytzinger_lower_bound(e, next_key(e->size));
+}
+
+size_t eytzinger_kary(const eytzinger_kary_t *e) {
+  return eytzinger_kary_lower_bound(e, next_key(e->size));
+}
+
+bool bplus_tree(const bptree *t) {
+  return bptree_find(t, (bptree_key) { .integer = next_key(t->count) }, NULL);
+}
+
+int main(void) {
+  size_t n = 1e7;
+  int64_t *sorted = malloc(n * sizeof(int64_t));
+  eytzinger_t e;
+  eytzinger_kary_t k;
+  bptree t;
+  mk_bptree(&t, NULL);
+  for (size_t i = 0; i < n; i++) {
+    sorted[i] = 2 * i;
+    bptree_insert(&t, (bptree_key) { .integer = sorted[i] }, NULL);
+  }
+  mk_eytzinger(&e, sorted, n);
+  mk_eytzinger_kary(&k, sorted, n);
+
+  benchmark(binary_search, sorted, n);
+  benchmark(eytzinger, &e);
+  benchmark(eytzinger_kary, &k);
+  benchmark(bplus_tree, &t);
+
+  destroy_eytzinger(&e);
+  destroy_eytzinger_kary(&k);
+  destroy_bptree(&t);
+  free(sorted);
+  return 0;
+}
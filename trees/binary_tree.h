@@ -1,4 +1,7 @@
+#ifndef __BINARY_TREE_H
+#define __BINARY_TREE_H
+
+// Compare two keys, returning a negative number, zero or a positive number if left is less than, equal to or greater than right
 typedef int (*compare_func_t)(const void* left, const void* right);
-typedef struct {
-  compare_func_t comparer;
-}
+
+#endif // __BINARY_TREE_H
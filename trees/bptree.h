@@ -0,0 +1,305 @@
+#ifndef __BPTREE_H
+#define __BPTREE_H
+
+// Ordered index implemented as a B+tree. Nodes hold up to BPTREE_KEYS keys in one contiguous
+// block, so a lookup touches a handful of nodes instead of one node per level of a binary tree.
+// Values are only stored in the leaves, and the leaves are linked in key order for range scans.
+//
+// Keys are either integers, compared with a vectorized branchless search, or pointers ordered
+// with a compare_func_t. Inner node key i is the largest key in child i.
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "binary_tree.h"
+
+// Keys per node. Must be a multiple of 4 for the vectorized search.
+#ifndef BPTREE_KEYS
+#define BPTREE_KEYS 32
+#endif
+
+typedef union {
+  const void *pointer;
+  int64_t integer;
+} bptree_key;
+
+typedef struct bptree_node bptree_node;
+struct bptree_node {
+  int n;     // Number of keys in use
+  bool leaf;
+  bptree_key keys[BPTREE_KEYS];  // Unused integer keys are INT64_MAX so they never compare below a key
+  union {
+    bptree_node *children[BPTREE_KEYS + 1];
+    struct {
+      void *values[BPTREE_KEYS];
+      bptree_node *next;
+    } leaf;
+  } u;
+};
+
+typedef struct {
+  compare_func_t comparer; // NULL for integer keys
+  bptree_node *root;
+  size_t count;
+} bptree;
+
+// Position of a key in a leaf, used to walk the keys in order
+typedef struct {
+  bptree_node *leaf;
+  int index;
+} bptree_cursor;
+
+// Make a new, empty tree. Keys are pointers ordered by comparer, or integers if comparer is NULL.
+void mk_bptree(bptree *t, compare_func_t comparer);
+// Free every node of the tree. Keys and values are not freed.
+void destroy_bptree(bptree *t);
+// Insert a key if it is not already in the tree, returning true if it was inserted
+bool bptree_insert(bptree *t, bptree_key key, void *value);
+// Return true if the key is in the tree, returning its value in *value
+bool bptree_find(const bptree *t, bptree_key key, void **value);
+// Delete a key, returning true if it was found. The deleted value is returned in *removed.
+// Underfull nodes are not merged; the tree keeps its shape until it is rebuilt.
+bool bptree_delete(bptree *t, bptree_key key, void **removed);
+// Return a cursor at the first key not less than key
+bptree_cursor bptree_lower_bound(const bptree *t, bptree_key key);
+// Return a cursor at the smallest key
+bptree_cursor bptree_first(const bptree *t);
+// Return true if the cursor points at a key
+static inline bool bptree_cursor_valid(const bptree_cursor *c) { return c->leaf != NULL; }
+static inline bptree_key bptree_cursor_key(const bptree_cursor *c) { return c->leaf->keys[c->index]; }
+static inline void *bptree_cursor_value(const bptree_cursor *c) { return c->leaf->u.leaf.values[c->index]; }
+// Advance the cursor to the next key
+void bptree_cursor_next(bptree_cursor *c);
+
+#endif // __BPTREE_H
+
+#ifdef BPTREE_IMPLEMENTATION
+#undef BPTREE_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+
+#if BPTREE_KEYS % 4
+#error BPTREE_KEYS must be a multiple of 4
+#endif
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define BPTREE_X86
+#include <immintrin.h>
+#endif
+
+static bptree_node *mk_node(const bptree *t, bool leaf) {
+  bptree_node *n;
+  // nodes start on a cache line
+  if (posix_memalign((void**)&n, 64, sizeof(bptree_node)))
+    return NULL;
+  memset(n, 0, sizeof(bptree_node));
+  n->leaf = leaf;
+  if (!t->comparer)
+    for (int i = 0; i < BPTREE_KEYS; i++)
+      n->keys[i].integer = INT64_MAX;
+  return n;
+}
+
+void mk_bptree(bptree *t, compare_func_t comparer) {
+  *t = (bptree) { .comparer = comparer };
+  t->root = mk_node(t, true);
+}
+
+// The depth is logarithmic in the fanout, so recursion is shallow
+static void destroy_node(bptree_node *n) {
+  if (!n->leaf)
+    for (int i = 0; i <= n->n; i++)
+      destroy_node(n->u.children[i]);
+  free(n);
+}
+
+void destroy_bptree(bptree *t) {
+  destroy_node(t->root);
+  t->root = NULL;
+  t->count = 0;
+}
+
+// Number of keys below key. Every slot is compared, so the loop has no branches on the keys.
+static int lower_index_portable(const bptree_key *keys, int64_t key) {
+  int count = 0;
+  for (int i = 0; i < BPTREE_KEYS; i++)
+    count += keys[i].integer < key;
+  return count;
+}
+
+#ifdef BPTREE_X86
+__attribute__((target("avx2,popcnt")))
+static int lower_index_avx2(const bptree_key *keys, int64_t key) {
+  const __m256i k = _mm256_set1_epi64x(key);
+  int count = 0;
+  for (int i = 0; i < BPTREE_KEYS; i += 4) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(keys + i));
+    count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(k, v))));
+  }
+  return count;
+}
+#endif
+
+static int __bptree_avx2 = -1;
+
+// Index of the first key in the node which is not less than key
+static inline int lower_index(const bptree *t, const bptree_node *n, bptree_key key) {
+  if (!t->comparer) {
+#ifdef BPTREE_X86
+    if (__bptree_avx2 < 0) {
+      __builtin_cpu_init();
+      __bptree_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    }
+    if (__bptree_avx2)
+      return lower_index_avx2(n->keys, key.integer);
+#endif
+    return lower_index_portable(n->keys, key.integer);
+  }
+  int lo = 0, hi = n->n;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (t->comparer(n->keys[mid].pointer, key.pointer) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static inline bool keys_equal(const bptree *t, bptree_key a, bptree_key b) {
+  return t->comparer ? t->comparer(a.pointer, b.pointer) == 0 : a.integer == b.integer;
+}
+
+// Descend to the leaf which holds key, or would hold it
+static bptree_node *find_leaf(const bptree *t, bptree_key key) {
+  bptree_node *n = t->root;
+  while (!n->leaf)
+    n = n->u.children[lower_index(t, n, key)];
+  return n;
+}
+
+bool bptree_find(const bptree *t, bptree_key key, void **value) {
+  bptree_node *leaf = find_leaf(t, key);
+  int i = lower_index(t, leaf, key);
+  if (i < leaf->n && keys_equal(t, leaf->keys[i], key)) {
+    if (value)
+      *value = leaf->u.leaf.values[i];
+    return true;
+  }
+  return false;
+}
+
+// Split the full child i of parent, which has room for one more key
+static void split_child(const bptree *t, bptree_node *parent, int i) {
+  bptree_node *child = parent->u.children[i];
+  bptree_node *right = mk_node(t, child->leaf);
+  int half = BPTREE_KEYS / 2;
+  bptree_key separator;
+
+  if (child->leaf) {
+    // the left half keeps its keys; the largest of them separates the halves
+    right->n = BPTREE_KEYS - half;
+    memcpy(right->keys, child->keys + half, right->n * sizeof(bptree_key));
+    memcpy(right->u.leaf.values, child->u.leaf.values + half, right->n * sizeof(void*));
+    right->u.leaf.next = child->u.leaf.next;
+    child->u.leaf.next = right;
+    child->n = half;
+    separator = child->keys[half - 1];
+  } else {
+    // key half - 1 moves up to the parent
+    right->n = BPTREE_KEYS - half;
+    memcpy(right->keys, child->keys + half, right->n * sizeof(bptree_key));
+    memcpy(right->u.children, child->u.children + half, (right->n + 1) * sizeof(bptree_node*));
+    child->n = half - 1;
+    separator = child->keys[half - 1];
+  }
+  if (!t->comparer)
+    for (int k = child->n; k < BPTREE_KEYS; k++)
+      child->keys[k].integer = INT64_MAX;
+
+  memmove(parent->keys + i + 1, parent->keys + i, (parent->n - i) * sizeof(bptree_key));
+  memmove(parent->u.children + i + 2, parent->u.children + i + 1, (parent->n - i) * sizeof(bptree_node*));
+  parent->keys[i] = separator;
+  parent->u.children[i + 1] = right;
+  parent->n++;
+}
+
+bool bptree_insert(bptree *t, bptree_key key, void *value) {
+  bptree_node *n = t->root;
+  int i;
+  // Full nodes are split on the way down, so a split never has to propagate back up
+  if (n->n == BPTREE_KEYS) {
+    bptree_node *root = mk_node(t, false);
+    root->u.children[0] = n;
+    split_child(t, root, 0);
+    t->root = n = root;
+  }
+  while (!n->leaf) {
+    i = lower_index(t, n, key);
+    if (n->u.children[i]->n == BPTREE_KEYS) {
+      split_child(t, n, i);
+      // the key may now belong to the new right half
+      i = lower_index(t, n, key);
+    }
+    n = n->u.children[i];
+  }
+
+  i = lower_index(t, n, key);
+  if (i < n->n && keys_equal(t, n->keys[i], key))
+    return false;
+  memmove(n->keys + i + 1, n->keys + i, (n->n - i) * sizeof(bptree_key));
+  memmove(n->u.leaf.values + i + 1, n->u.leaf.values + i, (n->n - i) * sizeof(void*));
+  n->keys[i] = key;
+  n->u.leaf.values[i] = value;
+  n->n++;
+  t->count++;
+  return true;
+}
+
+bool bptree_delete(bptree *t, bptree_key key, void **removed) {
+  bptree_node *leaf = find_leaf(t, key);
+  int i = lower_index(t, leaf, key);
+  if (i >= leaf->n || !keys_equal(t, leaf->keys[i], key))
+    return false;
+  if (removed)
+    *removed = leaf->u.leaf.values[i];
+  memmove(leaf->keys + i, leaf->keys + i + 1, (leaf->n - i - 1) * sizeof(bptree_key));
+  memmove(leaf->u.leaf.values + i, leaf->u.leaf.values + i + 1, (leaf->n - i - 1) * sizeof(void*));
+  leaf->n--;
+  if (!t->comparer)
+    leaf->keys[leaf->n].integer = INT64_MAX;
+  t->count--;
+  return true;
+}
+
+// Move a cursor past the end of its leaf on to the next leaf with keys
+static void skip_empty(bptree_cursor *c) {
+  while (c->leaf && c->index >= c->leaf->n) {
+    c->leaf = c->leaf->u.leaf.next;
+    c->index = 0;
+  }
+}
+
+bptree_cursor bptree_lower_bound(const bptree *t, bptree_key key) {
+  bptree_node *leaf = find_leaf(t, key);
+  bptree_cursor c = { .leaf = leaf, .index = lower_index(t, leaf, key) };
+  skip_empty(&c);
+  return c;
+}
+
+bptree_cursor bptree_first(const bptree *t) {
+  bptree_node *n = t->root;
+  while (!n->leaf)
+    n = n->u.children[0];
+  bptree_cursor c = { .leaf = n, .index = 0 };
+  skip_empty(&c);
+  return c;
+}
+
+void bptree_cursor_next(bptree_cursor *c) {
+  c->index++;
+  skip_empty(c);
+}
+
+#endif // BPTREE_IMPLEMENTATION
@@ -1,107 +1,43 @@
+#define BST_IMPLEMENTATION
+#include "bst.h"
 #include <stdio.h>
 #include <stdlib.h>
 
-typedef struct tree_t tree_t;
-typedef int key_t;
-typedef int value_t;
-
-struct tree_t {
-	value_t value;
-	tree_t *l, *r, *p;
-};
-
-int depth(tree_t *n) {
-	if (n) {
-		int l, r;
-		l = n->l ? depth(n->l) + 1 : 0;
-		r = n->r ? depth(n->r) + 1 : 0;
-		return l > r ? l : r;
-	}
-	return 0;
-}
-
-
 // print the root before the values in either subtree
 void preorder_treewalk(tree_t *root, int level){
-	if (root) {
-		printf("%d", root->value);
-		if (root->l){
-			printf(",");
-			printf("\n%*s(", level, "");
-			preorder_treewalk(root->l, level + 1);
-			printf(")");
-		}
-		if (root->r){
-			printf(",");
-			printf("\n%*s[", level, "");
-			preorder_treewalk(root->r, level + 1);
-			printf("]");
+	for (treewalk_t w = mk_treewalk(root, PREORDER); w.node; treewalk_step(&w)) {
+		tree_t *n = w.node;
+		int left = n->p && n == n->p->l;
+		if (w.visit == PREORDER) {
+			if (n != root) {
+				printf(",");
+				printf("\n%*s%c", level + w.level - 1, "", left ? '(' : '[');
+			}
+			printf("%d", n->value);
+		} else if (w.visit == POSTORDER && n != root) {
+			printf("%c", left ? ')' : ']');
 		}
 	}
 }
 
 // print the root after the values in its subtrees
 void postorder_treewalk(tree_t *root){
-	if (root) {
-		postorder_treewalk(root->l);
-		postorder_treewalk(root->r);
-		printf(" - %d", root->value);
-	}
+	for (treewalk_t w = mk_treewalk(root, POSTORDER); treewalk_next(&w);)
+		printf(" - %d", w.node->value);
 }
 
 // print the key of the root of a subtree between printing the values in its left subtree and right subtree
 void inorder_treewalk(tree_t *root){
-	if (root) {
-		printf(" down ");
-		inorder_treewalk(root->l);
-		printf("%d", root->value);
-		inorder_treewalk(root->r);
-		printf(" up ");
-	}
-}
-
-tree_t *mk_tree(value_t value) {
-	tree_t *r = calloc(sizeof(tree_t), 1);
-	r->value = value;
-	return r;
-}
-
-void destroy_tree(tree_t *root){
-	if (root) {
-		destroy_tree(root->l);
-		destroy_tree(root->r);
-		free(root);
+	for (treewalk_t w = mk_treewalk(root, PREORDER); w.node; treewalk_step(&w)) {
+		if (w.visit == PREORDER)
+			printf(" down ");
+		else if (w.visit == INORDER)
+			printf("%d", w.node->value);
+		else
+			printf(" up ");
 	}
 }
 
-void _insert(tree_t *node, tree_t *v){
-	v->p = node;
-	if (v->value < node->value) {
-		if (node->l) {
-			_insert(node->l, v);
-		} else {
-			node->l = v;
-		}
-	} else {
-		if (node->r) {
-			_insert(node->r, v);
-		} else {
-			node->r = v;
-		}
-	}
-}
-
-tree_t *insert(tree_t *tree, value_t value) {
-	tree_t *v = mk_tree(value);
-	if (!tree)
-		return v;
-
-	while (tree->p)
-		tree = tree->p;
-	_insert(tree, v);
-	return v;
-}
-
 #define t(...) &(tree_t) { __VA_ARGS__ }
 int main(void){
 	tree_t *root = NULL;
@@ -113,8 +49,19 @@ int main(void){
 
 	preorder_treewalk(root, 0);
 	
-	printf("\n\ndepth: %d\n", depth(root));
+	printf("\n\ndepth: %d\n", tree_depth(root));
+
+	printf("sorted:");
+	for (treewalk_t w = mk_treewalk(root, INORDER); treewalk_next(&w);)
+		printf(" %d", w.node->value);
+	printf("\n");
 
+	destroy_tree(root);
+
+	root = mk_tree_sorted(set, sizeof(set) / sizeof(set[0]), 0);
+	printf("\nbalanced:\n");
+	preorder_treewalk(root, 0);
+	printf("\n\ndepth: %d\n", tree_depth(root));
 	destroy_tree(root);
 	return 0;
 }
@@ -0,0 +1,197 @@
+#ifndef __BST_H
+#define __BST_H
+
+// Unbalanced binary search tree of int values, and stackless cursors which walk any binary tree
+// linked through l, r and p pointers in preorder, inorder or postorder.
+
+typedef int value_t;
+
+typedef struct tree_t tree_t;
+struct tree_t {
+  value_t value;
+  tree_t *l, *r, *p;
+  int block;  // BST_BLOCK_START or BST_BLOCK_NODE for nodes made together by mk_tree_sorted
+};
+
+enum { BST_SEPARATE, BST_BLOCK_START, BST_BLOCK_NODE };
+
+// Which of the three visits to a node a walk is at: before its left subtree, between its subtrees or after its right subtree
+typedef enum { PREORDER, INORDER, POSTORDER } order_t;
+
+// Cursor over a subtree. It only follows the l, r and p pointers, so it needs no stack and the tree is not modified.
+typedef struct {
+  tree_t *node;   // Current node, or NULL when the walk is done
+  tree_t *stop;   // Parent of the root of the walk
+  order_t visit;  // Which visit to node the walk is at
+  int level;      // Depth of node below the root of the walk
+  order_t order;  // Order in which treewalk_next returns the nodes
+  int started;
+} treewalk_t;
+
+// Start a walk over the subtree rooted at root, returning the nodes in the given order
+treewalk_t mk_treewalk(tree_t *root, order_t order);
+// Advance to the next visit of the walk, returning the node or NULL when the walk is done
+tree_t *treewalk_step(treewalk_t *w);
+// Return the next node in the order of the walk, or NULL when every node has been returned
+tree_t *treewalk_next(treewalk_t *w);
+// Number of edges on the longest path from n to a leaf
+int tree_depth(tree_t *n);
+
+// Make a tree of a single node
+tree_t *mk_tree(value_t value);
+// Build a balanced tree of n values in O(n), plus a sort unless sorted is set, which sorts values in
+// place. The nodes are allocated in one block which starts at the returned root.
+tree_t *mk_tree_sorted(value_t *values, int n, int sorted);
+// Free every node of the subtree rooted at root. Nodes of a block from mk_tree_sorted are freed
+// together with its root.
+void destroy_tree(tree_t *root);
+// Insert a value below the root of the tree holding node, returning the new node
+tree_t *insert(tree_t *tree, value_t value);
+
+#endif // __BST_H
+
+#ifdef BST_IMPLEMENTATION
+#undef BST_IMPLEMENTATION
+#include <stdlib.h>
+
+treewalk_t mk_treewalk(tree_t *root, order_t order) {
+  return (treewalk_t) { .node = root, .stop = root ? root->p : NULL, .visit = PREORDER, .order = order };
+}
+
+tree_t *treewalk_step(treewalk_t *w) {
+  tree_t *n = w->node;
+  if (!n)
+    return NULL;
+  if (w->visit == PREORDER) {
+    if (n->l) {
+      w->node = n->l;
+      w->level++;
+    } else {
+      w->visit = INORDER;
+    }
+  } else if (w->visit == INORDER) {
+    if (n->r) {
+      w->node = n->r;
+      w->visit = PREORDER;
+      w->level++;
+    } else {
+      w->visit = POSTORDER;
+    }
+  } else if (n->p == w->stop) {
+    w->node = NULL;
+  } else {
+    w->node = n->p;
+    w->visit = n == n->p->l ? INORDER : POSTORDER;
+    w->level--;
+  }
+  return w->node;
+}
+
+tree_t *treewalk_next(treewalk_t *w) {
+  if (w->started)
+    treewalk_step(w);
+  w->started = 1;
+  while (w->node && w->visit != w->order)
+    treewalk_step(w);
+  return w->node;
+}
+
+int tree_depth(tree_t *n) {
+  int max = 0;
+  for (treewalk_t w = mk_treewalk(n, PREORDER); treewalk_next(&w);)
+    max = w.level > max ? w.level : max;
+  return max;
+}
+
+tree_t *mk_tree(value_t value) {
+  tree_t *r = calloc(sizeof(tree_t), 1);
+  r->value = value;
+  return r;
+}
+
+// free leaves first, detaching each from its parent, so no stack is needed
+void destroy_tree(tree_t *root) {
+  tree_t *stop = root ? root->p : NULL, *n = root;
+  while (n != stop) {
+    if (n->l) {
+      n = n->l;
+    } else if (n->r) {
+      n = n->r;
+    } else {
+      tree_t *p = n->p;
+      if (p) {
+        if (p->l == n)
+          p->l = NULL;
+        else
+          p->r = NULL;
+      }
+      if (n->block != BST_BLOCK_NODE)
+        free(n);
+      n = p;
+    }
+  }
+}
+
+static int bst_compare_values(const void *left, const void *right) {
+  value_t l = *(const value_t*)left, r = *(const value_t*)right;
+  return (l > r) - (l < r);
+}
+
+tree_t *mk_tree_sorted(value_t *values, int n, int sorted) {
+  tree_t *nodes;
+  int k = 0;
+  if (n <= 0)
+    return NULL;
+  if (!sorted)
+    qsort(values, n, sizeof(value_t), bst_compare_values);
+
+  // node k has children 2k+1 and 2k+2, which makes the tree complete
+  nodes = malloc(n * sizeof(tree_t));
+  for (int i = 0; i < n; i++) {
+    nodes[i].l = 2 * i + 1 < n ? &nodes[2 * i + 1] : NULL;
+    nodes[i].r = 2 * i + 2 < n ? &nodes[2 * i + 2] : NULL;
+    nodes[i].p = i ? &nodes[(i - 1) / 2] : NULL;
+    nodes[i].block = i ? BST_BLOCK_NODE : BST_BLOCK_START;
+  }
+  // hand out the values during an in-order walk of the node indices
+  while (2 * k + 1 < n)
+    k = 2 * k + 1;
+  for (int i = 0; i < n; i++) {
+    nodes[k].value = values[i];
+    if (2 * k + 2 < n) {
+      k = 2 * k + 2;
+      while (2 * k + 1 < n)
+        k = 2 * k + 1;
+    } else {
+      while (k && k % 2 == 0)
+        k = (k - 1) / 2;
+      k = (k - 1) / 2;
+    }
+  }
+  return nodes;
+}
+
+static void bst_insert_below(tree_t *node, tree_t *v) {
+  for (;;) {
+    tree_t **child = v->value < node->value ? &node->l : &node->r;
+    if (!*child) {
+      *child = v;
+      v->p = node;
+      return;
+    }
+    node = *child;
+  }
+}
+
+tree_t *insert(tree_t *tree, value_t value) {
+  tree_t *v = mk_tree(value);
+  if (!tree)
+    return v;
+
+  while (tree->p)
+    tree = tree->p;
+  bst_insert_below(tree, v);
+  return v;
+}
+
+#endif // BST_IMPLEMENTATION
@@ -0,0 +1,223 @@
+#ifndef __EYTZINGER_H
+#define __EYTZINGER_H
+
+// Static search trees over a sorted set of integer keys, stored without pointers.
+//  * eytzinger_t stores the keys in breadth first order, so the children of keys[k] are keys[2k]
+//    and keys[2k + 1]. The search loop has no branches, and the keys three levels down share a
+//    cache line which is prefetched while the levels above are searched.
+//  * eytzinger_kary_t stores EYTZINGER_KARY_B keys per cache line in a static B-tree, where block k
+//    has children k(B + 1) + 1 ... k(B + 1) + B + 1. Each block is searched with one vector compare.
+// Both are built in O(n) from sorted keys and cannot be modified.
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Keys per block of the k-ary tree; one cache line of keys
+#define EYTZINGER_KARY_B 8
+
+typedef struct {
+  size_t size;
+  int64_t *keys; // keys[0] is unused
+} eytzinger_t;
+
+typedef struct {
+  size_t size;   // Number of keys
+  size_t blocks;
+  int64_t max;   // Largest key; slots past the last key are padded with INT64_MAX
+  int64_t *keys;
+} eytzinger_kary_t;
+
+// Make a tree from n sorted keys
+void mk_eytzinger(eytzinger_t *e, const int64_t *sorted, size_t n);
+// Destroy the given tree
+void destroy_eytzinger(eytzinger_t *e);
+// Return the index in e->keys of the first key not less than key, or 0 if every key is less
+size_t eytzinger_lower_bound(const eytzinger_t *e, int64_t key);
+// Return true if the key is in the tree
+bool eytzinger_find(const eytzinger_t *e, int64_t key);
+
+// Make a k-ary tree from n sorted keys
+void mk_eytzinger_kary(eytzinger_kary_t *e, const int64_t *sorted, size_t n);
+// Destroy the given k-ary tree
+void destroy_eytzinger_kary(eytzinger_kary_t *e);
+// Return the index in e->keys of the first key not less than key, or the number of slots if every key is less
+size_t eytzinger_kary_lower_bound(const eytzinger_kary_t *e, int64_t key);
+// Return true if the key is in the tree
+bool eytzinger_kary_find(const eytzinger_kary_t *e, int64_t key);
+
+#ifdef __BPTREE_H
+// Make trees from the keys of an integer keyed B+tree
+void mk_eytzinger_bptree(eytzinger_t *e, const bptree *t);
+void mk_eytzinger_kary_bptree(eytzinger_kary_t *e, const bptree *t);
+#endif
+
+#endif // __EYTZINGER_H
+
+#ifdef EYTZINGER_IMPLEMENTATION
+#undef EYTZINGER_IMPLEMENTATION
+
+#include <stdlib.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define EYTZINGER_X86
+#include <immintrin.h>
+#endif
+
+// Keys start on a cache line
+static int64_t *alloc_keys(size_t n) {
+  int64_t *keys;
+  if (posix_memalign((void**)&keys, 64, (n ? n : 1) * sizeof(int64_t)))
+    return NULL;
+  return keys;
+}
+
+void mk_eytzinger(eytzinger_t *e, const int64_t *sorted, size_t n) {
+  size_t k = 1;
+  *e = (eytzinger_t) { .size = n, .keys = alloc_keys(n + 1) };
+  e->keys[0] = INT64_MIN;
+  if (!n)
+    return;
+  // hand out the keys during an in-order walk of the indices
+  while (2 * k <= n)
+    k = 2 * k;
+  for (size_t i = 0; i < n; i++) {
+    e->keys[k] = sorted[i];
+    if (2 * k + 1 <= n) {
+      k = 2 * k + 1;
+      while (2 * k <= n)
+        k = 2 * k;
+    } else {
+      // climb past every level where k is a right child
+      k >>= __builtin_ctzll(~(unsigned long long)k) + 1;
+    }
+  }
+}
+
+void destroy_eytzinger(eytzinger_t *e) {
+  free(e->keys);
+  e->keys = NULL;
+}
+
+size_t eytzinger_lower_bound(const eytzinger_t *e, int64_t key) {
+  size_t k = 1;
+  while (k <= e->size) {
+    // keys[8k] ... keys[8k + 7] are the descendants three levels down. The address is only
+    // a hint, so it is computed without pointer arithmetic past the end of the array.
+    __builtin_prefetch((const void*)((uintptr_t)e->keys + 8 * k * sizeof(int64_t)));
+    k = 2 * k + (e->keys[k] < key);
+  }
+  // every step to the right was a key less than key; undo them, and the last step to the left
+  return k >> (__builtin_ctzll(~(unsigned long long)k) + 1);
+}
+
+bool eytzinger_find(const eytzinger_t *e, int64_t key) {
+  size_t k = eytzinger_lower_bound(e, key);
+  return k && e->keys[k] == key;
+}
+
+// Fill block k and its subtrees in order, returning the position of the next sorted key
+static size_t kary_fill(eytzinger_kary_t *e, const int64_t *sorted, size_t t, size_t k) {
+  // the depth is logarithmic in the fanout, so recursion is shallow
+  if (k >= e->blocks)
+    return t;
+  for (size_t i = 0; i < EYTZINGER_KARY_B; i++) {
+    t = kary_fill(e, sorted, t, k * (EYTZINGER_KARY_B + 1) + i + 1);
+    e->keys[k * EYTZINGER_KARY_B + i] = t < e->size ? sorted[t++] : INT64_MAX;
+  }
+  return kary_fill(e, sorted, t, k * (EYTZINGER_KARY_B + 1) + EYTZINGER_KARY_B + 1);
+}
+
+void mk_eytzinger_kary(eytzinger_kary_t *e, const int64_t *sorted, size_t n) {
+  *e = (eytzinger_kary_t) {
+    .size = n,
+    .blocks = (n + EYTZINGER_KARY_B - 1) / EYTZINGER_KARY_B,
+    .max = n ? sorted[n - 1] : INT64_MIN,
+  };
+  e->keys = alloc_keys(e->blocks * EYTZINGER_KARY_B);
+  kary_fill(e, sorted, 0, 0);
+}
+
+void destroy_eytzinger_kary(eytzinger_kary_t *e) {
+  free(e->keys);
+  e->keys = NULL;
+}
+
+// Number of keys in a block less than key
+static int kary_rank_portable(const int64_t *block, int64_t key) {
+  int count = 0;
+  for (int i = 0; i < EYTZINGER_KARY_B; i++)
+    count += block[i] < key;
+  return count;
+}
+
+#ifdef EYTZINGER_X86
+__attribute__((target("avx2,popcnt")))
+static size_t kary_lower_bound_avx2(const eytzinger_kary_t *e, int64_t key) {
+  const __m256i k = _mm256_set1_epi64x(key);
+  size_t block = 0, result = e->blocks * EYTZINGER_KARY_B;
+  while (block < e->blocks) {
+    const int64_t *keys = e->keys + block * EYTZINGER_KARY_B;
+    __m256i lo = _mm256_cmpgt_epi64(k, _mm256_load_si256((const __m256i*)keys));
+    __m256i hi = _mm256_cmpgt_epi64(k, _mm256_load_si256((const __m256i*)(keys + 4)));
+    int mask = _mm256_movemask_pd(_mm256_castsi256_pd(lo)) | _mm256_movemask_pd(_mm256_castsi256_pd(hi)) << 4;
+    size_t i = __builtin_popcount(mask);
+    result = i < EYTZINGER_KARY_B ? block * EYTZINGER_KARY_B + i : result;
+    block = block * (EYTZINGER_KARY_B + 1) + i + 1;
+  }
+  return result;
+}
+#endif
+
+static int __eytzinger_avx2 = -1;
+
+size_t eytzinger_kary_lower_bound(const eytzinger_kary_t *e, int64_t key) {
+  size_t block = 0, result = e->blocks * EYTZINGER_KARY_B;
+  // the padding compares equal to INT64_MAX, so a key larger than every key has no lower bound
+  if (key > e->max)
+    return result;
+#ifdef EYTZINGER_X86
+  if (__eytzinger_avx2 < 0) {
+    __builtin_cpu_init();
+    __eytzinger_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+  }
+  if (__eytzinger_avx2)
+    return kary_lower_bound_avx2(e, key);
+#endif
+  while (block < e->blocks) {
+    size_t i = kary_rank_portable(e->keys + block * EYTZINGER_KARY_B, key);
+    result = i < EYTZINGER_KARY_B ? block * EYTZINGER_KARY_B + i : result;
+    block = block * (EYTZINGER_KARY_B + 1) + i + 1;
+  }
+  return result;
+}
+
+bool eytzinger_kary_find(const eytzinger_kary_t *e, int64_t key) {
+  size_t i = eytzinger_kary_lower_bound(e, key);
+  return i < e->blocks * EYTZINGER_KARY_B && e->keys[i] == key;
+}
+
+#ifdef __BPTREE_H
+// Copy the keys of a B+tree out in order
+static int64_t *bptree_keys(const bptree *t) {
+  int64_t *sorted = malloc((t->count ? t->count : 1) * sizeof(int64_t));
+  size_t i = 0;
+  for (bptree_cursor c = bptree_first(t); bptree_cursor_valid(&c); bptree_cursor_next(&c))
+    sorted[i++] = bptree_cursor_key(&c).integer;
+  return sorted;
+}
+
+void mk_eytzinger_bptree(eytzinger_t *e, const bptree *t) {
+  int64_t *sorted = bptree_keys(t);
+  mk_eytzinger(e, sorted, t->count);
+  free(sorted);
+}
+
+void mk_eytzinger_kary_bptree(eytzinger_kary_t *e, const bptree *t) {
+  int64_t *sorted = bptree_keys(t);
+  mk_eytzinger_kary(e, sorted, t->count);
+  free(sorted);
+}
+#endif
+
+#endif // EYTZINGER_IMPLEMENTATION
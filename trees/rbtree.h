@@ -0,0 +1,319 @@
+#ifndef __RBTREE_H
+#define __RBTREE_H
+
+// Ordered map implemented as a red-black tree. Every operation is iterative and O(log n).
+// Keys and values are pointers owned by the caller. Keys are ordered with a compare_func_t.
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "binary_tree.h"
+
+typedef struct rbnode rbnode;
+struct rbnode {
+  const void *key;
+  void *value;
+  rbnode *l, *r, *p;
+  bool red;
+};
+
+typedef struct {
+  compare_func_t comparer;
+  rbnode *root;
+  size_t count;
+} rbtree;
+
+// Make a new, empty tree ordered by comparer
+void mk_rbtree(rbtree *t, compare_func_t comparer);
+// Free every node of the tree. Keys and values are not freed.
+void destroy_rbtree(rbtree *t);
+// Insert a key if it is not already in the tree, returning true if it was inserted
+bool rbtree_insert(rbtree *t, const void *key, void *value);
+// Return the node with the given key, or NULL
+rbnode *rbtree_find(const rbtree *t, const void *key);
+// Delete the node with the given key, returning true if it was found. The deleted value is returned in *removed.
+bool rbtree_delete(rbtree *t, const void *key, void **removed);
+// Return the first node whose key is not less than key, or NULL
+rbnode *rbtree_lower_bound(const rbtree *t, const void *key);
+// Return the node with the smallest key, or NULL if the tree is empty
+rbnode *rbtree_first(const rbtree *t);
+// Return the node following n in key order, or NULL
+rbnode *rbtree_next(const rbnode *n);
+
+#endif // __RBTREE_H
+
+#ifdef RBTREE_IMPLEMENTATION
+#undef RBTREE_IMPLEMENTATION
+
+#include <stdlib.h>
+
+void mk_rbtree(rbtree *t, compare_func_t comparer) {
+  *t = (rbtree) { .comparer = comparer };
+}
+
+void destroy_rbtree(rbtree *t) {
+  // Free leaves first, detaching each from its parent, so no stack is needed
+  rbnode *n = t->root;
+  while (n) {
+    if (n->l) {
+      n = n->l;
+    } else if (n->r) {
+      n = n->r;
+    } else {
+      rbnode *p = n->p;
+      if (p) {
+        if (p->l == n)
+          p->l = NULL;
+        else
+          p->r = NULL;
+      }
+      free(n);
+      n = p;
+    }
+  }
+  t->root = NULL;
+  t->count = 0;
+}
+
+static rbnode *minimum(rbnode *n) {
+  while (n->l)
+    n = n->l;
+  return n;
+}
+
+rbnode *rbtree_first(const rbtree *t) {
+  return t->root ? minimum(t->root) : NULL;
+}
+
+rbnode *rbtree_next(const rbnode *n) {
+  if (n->r)
+    return minimum(n->r);
+  while (n->p && n == n->p->r)
+    n = n->p;
+  return n->p;
+}
+
+rbnode *rbtree_find(const rbtree *t, const void *key) {
+  rbnode *n = t->root;
+  while (n) {
+    int c = t->comparer(key, n->key);
+    if (c == 0)
+      return n;
+    n = c < 0 ? n->l : n->r;
+  }
+  return NULL;
+}
+
+rbnode *rbtree_lower_bound(const rbtree *t, const void *key) {
+  rbnode *n = t->root, *bound = NULL;
+  while (n) {
+    if (t->comparer(n->key, key) >= 0) {
+      bound = n;
+      n = n->l;
+    } else {
+      n = n->r;
+    }
+  }
+  return bound;
+}
+
+// Replace the subtree rooted at u with the subtree rooted at v
+static void transplant(rbtree *t, rbnode *u, rbnode *v) {
+  if (!u->p)
+    t->root = v;
+  else if (u == u->p->l)
+    u->p->l = v;
+  else
+    u->p->r = v;
+  if (v)
+    v->p = u->p;
+}
+
+static void rotate_left(rbtree *t, rbnode *x) {
+  rbnode *y = x->r;
+  x->r = y->l;
+  if (y->l)
+    y->l->p = x;
+  transplant(t, x, y);
+  y->l = x;
+  x->p = y;
+}
+
+static void rotate_right(rbtree *t, rbnode *x) {
+  rbnode *y = x->l;
+  x->l = y->r;
+  if (y->r)
+    y->r->p = x;
+  transplant(t, x, y);
+  y->r = x;
+  x->p = y;
+}
+
+#define is_red(n) ((n) && (n)->red)
+
+bool rbtree_insert(rbtree *t, const void *key, void *value) {
+  rbnode *parent = NULL, *n = t->root, *z, *p, *g, *u;
+  int c = 0;
+  while (n) {
+    c = t->comparer(key, n->key);
+    if (c == 0)
+      return false;
+    parent = n;
+    n = c < 0 ? n->l : n->r;
+  }
+
+  z = malloc(sizeof(rbnode));
+  *z = (rbnode) { .key = key, .value = value, .p = parent, .red = true };
+  if (!parent)
+    t->root = z;
+  else if (c < 0)
+    parent->l = z;
+  else
+    parent->r = z;
+  t->count++;
+
+  // Restore the red-black properties. p is red, so it is not the root and g exists.
+  while (is_red(p = z->p)) {
+    g = p->p;
+    if (p == g->l) {
+      u = g->r;
+      if (is_red(u)) {
+        p->red = u->red = false;
+        g->red = true;
+        z = g;
+        continue;
+      }
+      if (z == p->r) {
+        rotate_left(t, p);
+        z = p;
+        p = z->p;
+      }
+      p->red = false;
+      g->red = true;
+      rotate_right(t, g);
+    } else {
+      u = g->l;
+      if (is_red(u)) {
+        p->red = u->red = false;
+        g->red = true;
+        z = g;
+        continue;
+      }
+      if (z == p->l) {
+        rotate_right(t, p);
+        z = p;
+        p = z->p;
+      }
+      p->red = false;
+      g->red = true;
+      rotate_left(t, g);
+    }
+  }
+  t->root->red = false;
+  return true;
+}
+
+// x took the place of a removed black node below xp. x may be NULL, which is why its parent is passed separately.
+static void delete_fixup(rbtree *t, rbnode *x, rbnode *xp) {
+  rbnode *w;
+  while (x != t->root && !is_red(x)) {
+    if (x == xp->l) {
+      w = xp->r;
+      if (w->red) {
+        w->red = false;
+        xp->red = true;
+        rotate_left(t, xp);
+        w = xp->r;
+      }
+      if (!is_red(w->l) && !is_red(w->r)) {
+        w->red = true;
+        x = xp;
+        xp = x->p;
+      } else {
+        if (!is_red(w->r)) {
+          w->l->red = false;
+          w->red = true;
+          rotate_right(t, w);
+          w = xp->r;
+        }
+        w->red = xp->red;
+        xp->red = false;
+        w->r->red = false;
+        rotate_left(t, xp);
+        x = t->root;
+      }
+    } else {
+      w = xp->l;
+      if (w->red) {
+        w->red = false;
+        xp->red = true;
+        rotate_right(t, xp);
+        w = xp->l;
+      }
+      if (!is_red(w->l) && !is_red(w->r)) {
+        w->red = true;
+        x = xp;
+        xp = x->p;
+      } else {
+        if (!is_red(w->l)) {
+          w->r->red = false;
+          w->red = true;
+          rotate_left(t, w);
+          w = xp->l;
+        }
+        w->red = xp->red;
+        xp->red = false;
+        w->l->red = false;
+        rotate_right(t, xp);
+        x = t->root;
+      }
+    }
+  }
+  if (x)
+    x->red = false;
+}
+
+bool rbtree_delete(rbtree *t, const void *key, void **removed) {
+  rbnode *z = rbtree_find(t, key), *y, *x, *xp;
+  bool removed_black;
+  if (!z)
+    return false;
+  if (removed)
+    *removed = z->value;
+
+  removed_black = !z->red;
+  if (!z->l) {
+    x = z->r;
+    xp = z->p;
+    transplant(t, z, z->r);
+  } else if (!z->r) {
+    x = z->l;
+    xp = z->p;
+    transplant(t, z, z->l);
+  } else {
+    // z has two children; its successor y takes its place
+    y = minimum(z->r);
+    removed_black = !y->red;
+    x = y->r;
+    if (y->p == z) {
+      xp = y;
+    } else {
+      xp = y->p;
+      transplant(t, y, y->r);
+      y->r = z->r;
+      y->r->p = y;
+    }
+    transplant(t, z, y);
+    y->l = z->l;
+    y->l->p = y;
+    y->red = z->red;
+  }
+  free(z);
+  t->count--;
+  if (removed_black)
+    delete_fixup(t, x, xp);
+  return true;
+}
+
+#undef is_red
+
+#endif // RBTREE_IMPLEMENTATION
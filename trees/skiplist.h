@@ -0,0 +1,366 @@
+#ifndef __SKIPLIST_H
+#define __SKIPLIST_H
+
+// Concurrent ordered map implemented as a lock-free skiplist. A node is deleted by marking the
+// lowest bit of its next pointers, top level first; the mark on level 0 decides which thread
+// deleted it. Traversals unlink marked nodes as they pass them.
+//
+// Unlinked nodes are freed with epoch-based reclamation: each thread announces the global epoch
+// when it starts an operation, and a node unlinked in epoch e is only freed once the global epoch
+// has passed e + 2, when no operation which could have seen the node is still running.
+//
+// Each thread joins the list to get a handle, and passes the handle to every operation.
+// Keys and values are pointers owned by the caller. Keys are ordered with a compare_func_t.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "binary_tree.h"
+
+#define SKIPLIST_MAX_LEVEL 24
+// Retired nodes per thread between attempts to advance the epoch
+#define SKIPLIST_RETIRE_BATCH 64
+// Called by a thread between reading the global epoch and announcing it; tests use it to stall there
+#ifndef SKIPLIST_ENTER_HOOK
+#define SKIPLIST_ENTER_HOOK(h)
+#endif
+
+typedef struct skipnode skipnode;
+struct skipnode {
+  const void *key;
+  void *value;
+  int height;
+  int refs;          // The inserting and the deleting thread; the last to finish frees the node
+  skipnode *retired; // Next node in a list of unlinked nodes
+  skipnode *next[];
+};
+
+typedef struct skiplist skiplist;
+typedef struct skiplist_handle skiplist_handle;
+
+struct skiplist_handle {
+  skiplist *list;
+  skiplist_handle *next;
+  uint64_t announced;         // (epoch << 1) | 1 while an operation is running, 0 otherwise
+  bool joined;                // A thread is using the handle
+  uint64_t limbo_epoch[3];    // Epoch in which the nodes of each limbo list were retired
+  skipnode *limbo[3];
+  size_t retired;
+  uint64_t seed;
+};
+
+struct skiplist {
+  compare_func_t comparer;
+  skipnode *head;
+  uint64_t epoch;
+  skiplist_handle *threads;
+};
+
+// Called for each key in order. Return nonzero to stop the scan.
+typedef int (*skiplist_callback)(void *data, const void *key, void *value);
+
+// Make a new, empty list ordered by comparer
+void mk_skiplist(skiplist *s, compare_func_t comparer);
+// Free every node of the list. Keys and values are not freed. No thread may be using the list.
+void destroy_skiplist(skiplist *s);
+// Get a handle for the calling thread. Each thread needs its own handle.
+skiplist_handle *skiplist_join(skiplist *s);
+// Give up a handle when the thread is done with the list
+void skiplist_leave(skiplist_handle *h);
+// Insert a key if it is not already in the list, returning true if it was inserted
+bool skiplist_insert(skiplist_handle *h, const void *key, void *value);
+// Return true if the key is in the list, returning its value in *value
+bool skiplist_find(skiplist_handle *h, const void *key, void **value);
+// Delete a key, returning true if this call deleted it. The deleted value is returned in *removed.
+bool skiplist_delete(skiplist_handle *h, const void *key, void **removed);
+// Call cb in order for the keys in [lo, hi), where NULL is unbounded, returning the first nonzero
+// result of cb. Keys inserted or deleted during the scan may or may not be seen.
+int skiplist_range(skiplist_handle *h, const void *lo, const void *hi, skiplist_callback cb, void *data);
+
+#endif // __SKIPLIST_H
+
+#ifdef SKIPLIST_IMPLEMENTATION
+#undef SKIPLIST_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+
+#define is_marked(p) ((uintptr_t)(p) & 1)
+#define marked(p) ((skipnode*)((uintptr_t)(p) | 1))
+#define unmarked(p) ((skipnode*)((uintptr_t)(p) & ~(uintptr_t)1))
+#define load(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define cas(p, expected, desired) __atomic_compare_exchange_n(p, &(skipnode*){ expected }, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+static skipnode *mk_skipnode(const void *key, void *value, int height) {
+  skipnode *n = malloc(sizeof(skipnode) + height * sizeof(skipnode*));
+  *n = (skipnode) { .key = key, .value = value, .height = height, .refs = 2 };
+  memset(n->next, 0, height * sizeof(skipnode*));
+  return n;
+}
+
+void mk_skiplist(skiplist *s, compare_func_t comparer) {
+  *s = (skiplist) { .comparer = comparer, .head = mk_skipnode(NULL, NULL, SKIPLIST_MAX_LEVEL) };
+}
+
+static void free_retired(skipnode *n) {
+  while (n) {
+    skipnode *next = n->retired;
+    free(n);
+    n = next;
+  }
+}
+
+void destroy_skiplist(skiplist *s) {
+  skipnode *n = s->head;
+  while (n) {
+    skipnode *next = unmarked(n->next[0]);
+    free(n);
+    n = next;
+  }
+  for (skiplist_handle *h = s->threads, *next; h; h = next) {
+    next = h->next;
+    for (int i = 0; i < 3; i++)
+      free_retired(h->limbo[i]);
+    free(h);
+  }
+  *s = (skiplist) {0};
+}
+
+skiplist_handle *skiplist_join(skiplist *s) {
+  skiplist_handle *h;
+  // reuse a handle which a thread has left
+  for (h = load(&s->threads); h; h = h->next)
+    if (!load(&h->joined) && !__atomic_exchange_n(&h->joined, true, __ATOMIC_ACQ_REL))
+      return h;
+  // handles are written by their own thread and scanned by all, so keep them on separate cache lines
+  if (posix_memalign((void**)&h, 64, sizeof(skiplist_handle)))
+    return NULL;
+  *h = (skiplist_handle) { .list = s, .joined = true, .seed = (uintptr_t)h | 1 };
+  h->next = load(&s->threads);
+  while (!__atomic_compare_exchange_n(&s->threads, &h->next, h, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    ;
+  return h;
+}
+
+void skiplist_leave(skiplist_handle *h) {
+  __atomic_store_n(&h->joined, false, __ATOMIC_RELEASE);
+}
+
+// Announce the global epoch, and free the nodes retired three epochs ago
+static void enter(skiplist_handle *h) {
+  uint64_t e = load(&h->list->epoch), seen;
+  // until the thread is announced it does not hold the epoch back, so the epoch may have moved on
+  // before the announcement; announce again until it is the current epoch, which it then stays
+  // ahead of by at most one. The exchange keeps the reads of the operation below the announcement.
+  for (;; e = seen) {
+    SKIPLIST_ENTER_HOOK(h);
+    __atomic_exchange_n(&h->announced, e << 1 | 1, __ATOMIC_SEQ_CST);
+    seen = __atomic_load_n(&h->list->epoch, __ATOMIC_SEQ_CST);
+    if (seen == e)
+      break;
+  }
+  if (h->limbo_epoch[e % 3] != e) {
+    free_retired(h->limbo[e % 3]);
+    h->limbo[e % 3] = NULL;
+    h->limbo_epoch[e % 3] = e;
+  }
+}
+
+static void leave(skiplist_handle *h) {
+  __atomic_store_n(&h->announced, 0, __ATOMIC_RELEASE);
+}
+
+// Advance the global epoch if every running operation has announced it
+static void try_advance(skiplist *s) {
+  uint64_t e = load(&s->epoch);
+  for (skiplist_handle *h = load(&s->threads); h; h = h->next) {
+    uint64_t announced = __atomic_load_n(&h->announced, __ATOMIC_SEQ_CST);
+    if (announced && announced >> 1 != e)
+      return;
+  }
+  __atomic_compare_exchange_n(&s->epoch, &e, e + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+static void retire(skiplist_handle *h, skipnode *n) {
+  int i = (h->announced >> 1) % 3;
+  n->retired = h->limbo[i];
+  h->limbo[i] = n;
+  if (++h->retired % SKIPLIST_RETIRE_BATCH == 0)
+    try_advance(h->list);
+}
+
+// Levels are geometrically distributed with p = 1/2
+static int random_height(skiplist_handle *h) {
+  uint64_t x = h->seed;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  h->seed = x;
+  return 1 + __builtin_ctzll(x | (1ull << (SKIPLIST_MAX_LEVEL - 1)));
+}
+
+// Find the predecessors and successors of key on every level, unlinking marked nodes on the way.
+// With a target, nodes with an equal key are passed until the target is reached.
+// Returns the unmarked node with the key, or NULL.
+static skipnode *search(skiplist *s, const void *key, skipnode *target, skipnode **preds, skipnode **succs) {
+  skipnode *pred, *curr, *succ;
+retry:
+  pred = s->head;
+  for (int level = SKIPLIST_MAX_LEVEL - 1; level >= 0; level--) {
+    curr = unmarked(load(&pred->next[level]));
+    while (curr) {
+      succ = load(&curr->next[level]);
+      if (is_marked(succ)) {
+        if (!cas(&pred->next[level], curr, unmarked(succ)))
+          goto retry;
+        curr = unmarked(succ);
+        continue;
+      }
+      int c = s->comparer(curr->key, key);
+      if (c < 0 || (c == 0 && target && curr != target)) {
+        pred = curr;
+        curr = succ;
+      } else {
+        break;
+      }
+    }
+    if (preds) {
+      preds[level] = pred;
+      succs[level] = curr;
+    }
+  }
+  return curr && s->comparer(curr->key, key) == 0 ? curr : NULL;
+}
+
+// Drop a reference to a node. The last of the inserting and deleting threads unlinks and retires it.
+static void release(skiplist_handle *h, skipnode *n) {
+  if (__atomic_sub_fetch(&n->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    // the node is marked on every level, so searching for it unlinks it wherever it is still linked
+    search(h->list, n->key, n, NULL, NULL);
+    retire(h, n);
+  }
+}
+
+bool skiplist_insert(skiplist_handle *h, const void *key, void *value) {
+  skiplist *s = h->list;
+  skipnode *preds[SKIPLIST_MAX_LEVEL], *succs[SKIPLIST_MAX_LEVEL];
+  skipnode *n = mk_skipnode(key, value, random_height(h));
+  enter(h);
+  for (;;) {
+    if (search(s, key, NULL, preds, succs)) {
+      leave(h);
+      free(n);
+      return false;
+    }
+    for (int level = 0; level < n->height; level++)
+      n->next[level] = succs[level];
+    // the node is in the list once it is linked on level 0
+    if (cas(&preds[0]->next[0], succs[0], n))
+      break;
+  }
+
+  for (int level = 1; level < n->height; level++) {
+    for (;;) {
+      skipnode *next = load(&n->next[level]);
+      // stop if the node is being deleted
+      if (is_marked(next))
+        goto done;
+      if (next != succs[level] && !cas(&n->next[level], next, succs[level]))
+        continue;
+      if (cas(&preds[level]->next[level], succs[level], n))
+        break;
+      if (search(s, key, n, preds, succs) != n)
+        goto done;
+    }
+  }
+done:
+  release(h, n);
+  leave(h);
+  return true;
+}
+
+bool skiplist_find(skiplist_handle *h, const void *key, void **value) {
+  skiplist *s = h->list;
+  skipnode *pred = s->head, *curr = NULL;
+  enter(h);
+  // read only; marked nodes are skipped instead of unlinked
+  for (int level = SKIPLIST_MAX_LEVEL - 1; level >= 0; level--) {
+    curr = unmarked(load(&pred->next[level]));
+    while (curr) {
+      skipnode *succ = load(&curr->next[level]);
+      if (is_marked(succ)) {
+        curr = unmarked(succ);
+      } else if (s->comparer(curr->key, key) < 0) {
+        pred = curr;
+        curr = succ;
+      } else {
+        break;
+      }
+    }
+  }
+  bool found = curr && s->comparer(curr->key, key) == 0;
+  if (found && value)
+    *value = curr->value;
+  leave(h);
+  return found;
+}
+
+bool skiplist_delete(skiplist_handle *h, const void *key, void **removed) {
+  skiplist *s = h->list;
+  skipnode *n, *next;
+  enter(h);
+  n = search(s, key, NULL, NULL, NULL);
+  if (!n) {
+    leave(h);
+    return false;
+  }
+  // mark the upper levels, then race for the mark on level 0
+  for (int level = n->height - 1; level > 0; level--) {
+    next = load(&n->next[level]);
+    while (!is_marked(next) && !__atomic_compare_exchange_n(&n->next[level], &next, marked(next), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      ;
+  }
+  next = load(&n->next[0]);
+  for (;;) {
+    if (is_marked(next)) {
+      leave(h);
+      return false;
+    }
+    if (__atomic_compare_exchange_n(&n->next[0], &next, marked(next), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      break;
+  }
+  if (removed)
+    *removed = n->value;
+  release(h, n);
+  leave(h);
+  return true;
+}
+
+int skiplist_range(skiplist_handle *h, const void *lo, const void *hi, skiplist_callback cb, void *data) {
+  skiplist *s = h->list;
+  skipnode *preds[SKIPLIST_MAX_LEVEL], *succs[SKIPLIST_MAX_LEVEL], *n;
+  int r = 0;
+  enter(h);
+  if (lo) {
+    search(s, lo, NULL, preds, succs);
+    n = succs[0];
+  } else {
+    n = unmarked(load(&s->head->next[0]));
+  }
+  for (; n && !r; n = unmarked(load(&n->next[0]))) {
+    if (hi && s->comparer(n->key, hi) >= 0)
+      break;
+    if (!is_marked(load(&n->next[0])))
+      r = cb(data, n->key, n->value);
+  }
+  leave(h);
+  return r;
+}
+
+#undef is_marked
+#undef marked
+#undef unmarked
+#undef load
+#undef cas
+
+#endif // SKIPLIST_IMPLEMENTATION
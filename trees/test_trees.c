@@ -0,0 +1,691 @@
+#define RBTREE_IMPLEMENTATION
+#include "rbtree.h"
+#define BPTREE_IMPLEMENTATION
+#include "bptree.h"
+#define EYTZINGER_IMPLEMENTATION
+#include "eytzinger.h"
+#define ART_IMPLEMENTATION
+#include "art.h"
+// Lets test_skiplist_stalled_enter stall a thread between reading the epoch and announcing it
+struct skiplist_handle;
+void skiplist_stall(struct skiplist_handle *h);
+#define SKIPLIST_ENTER_HOOK(h) skiplist_stall(h)
+#define SKIPLIST_IMPLEMENTATION
+#include "skiplist.h"
+#define BST_IMPLEMENTATION
+#include "bst.h"
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include "../unittest/unittest.h"
+
+#define LENGTH(X) (sizeof(X) / sizeof(X[0]))
+
+int compare_int(const void *left, const void *right) {
+  int l = *(const int*)left, r = *(const int*)right;
+  return (l > r) - (l < r);
+}
+
+// Check the red-black properties of a subtree, returning its black height
+int rb_black_height(const rbnode *n) {
+  if (!n)
+    return 1;
+  if (n->l)
+    ASSERT(n->l->p == n && compare_int(n->l->key, n->key) < 0);
+  if (n->r)
+    ASSERT(n->r->p == n && compare_int(n->r->key, n->key) > 0);
+  if (n->red)
+    ASSERT(!(n->l && n->l->red) && !(n->r && n->r->red));
+  int l = rb_black_height(n->l);
+  ASSERT_EQ(l, rb_black_height(n->r));
+  return l + !n->red;
+}
+
+int rb_height(const rbnode *n) {
+  if (!n)
+    return 0;
+  int l = rb_height(n->l), r = rb_height(n->r);
+  return 1 + (l > r ? l : r);
+}
+
+// Sorted input used to degrade the bst into a list; a red-black tree stays within 2 log2(n + 1)
+void test_rbtree_sorted(void) {
+  int n = 1 << 17;
+  int *keys = malloc(n * sizeof(int));
+  rbtree t;
+  mk_rbtree(&t, compare_int);
+  for (int i = 0; i < n; i++) {
+    keys[i] = i;
+    ASSERT(rbtree_insert(&t, &keys[i], &keys[i]));
+  }
+  ASSERT(!t.root->red);
+  rb_black_height(t.root);
+  ASSERT(rb_height(t.root) <= 2 * 18);
+  ASSERT_EQ(t.count, (size_t)n);
+
+  int i = 0;
+  for (rbnode *node = rbtree_first(&t); node; node = rbtree_next(node), i++)
+    ASSERT_EQ(*(const int*)node->key, i);
+  ASSERT_EQ(i, n);
+
+  for (i = 0; i < n; i += 2) {
+    void *removed;
+    ASSERT(rbtree_delete(&t, &keys[i], &removed));
+    ASSERT(removed == &keys[i]);
+  }
+  rb_black_height(t.root);
+  ASSERT_EQ(t.count, (size_t)n / 2);
+  destroy_rbtree(&t);
+  free(keys);
+}
+
+// Random inserts and deletes, checked against a presence array
+void test_rbtree_random(void) {
+  int range = 5000;
+  int *keys = malloc(range * sizeof(int));
+  bool *present = calloc(range, sizeof(bool));
+  size_t count = 0;
+  rbtree t;
+  mk_rbtree(&t, compare_int);
+  srand(1);
+  for (int i = 0; i < range; i++)
+    keys[i] = i * 2;
+  for (int step = 0; step < 50000; step++) {
+    int k = rand() % range;
+    if (rand() % 3) {
+      ASSERT_EQ(rbtree_insert(&t, &keys[k], &keys[k]), !present[k]);
+      count += !present[k];
+      present[k] = true;
+    } else {
+      ASSERT_EQ(rbtree_delete(&t, &keys[k], NULL), present[k]);
+      count -= present[k];
+      present[k] = false;
+    }
+    ASSERT_EQ(t.count, count);
+    if (step % 5000 == 0)
+      rb_black_height(t.root);
+  }
+  rb_black_height(t.root);
+  for (int k = 0; k < range; k++) {
+    rbnode *found = rbtree_find(&t, &keys[k]);
+    ASSERT_EQ(found != NULL, present[k]);
+    // lower bound of an odd number that is not in the tree
+    int probe = keys[k] - 1;
+    int expected = k;
+    while (expected < range && !present[expected])
+      expected++;
+    rbnode *bound = rbtree_lower_bound(&t, &probe);
+    if (expected == range) {
+      ASSERT(bound == NULL);
+    } else {
+      ASSERT_EQ(*(const int*)bound->key, keys[expected]);
+    }
+  }
+  destroy_rbtree(&t);
+  ASSERT(t.root == NULL);
+  free(keys);
+  free(present);
+}
+
+// Check that every key of an integer subtree is in (lo, hi] and that the leaves are in order.
+// Returns the depth of the subtree, which must be the same for every child.
+int bp_check(const bptree_node *n, int64_t lo, int64_t hi) {
+  for (int i = 0; i < n->n; i++) {
+    ASSERT(n->keys[i].integer > lo && n->keys[i].integer <= hi);
+    if (i)
+      ASSERT(n->keys[i - 1].integer < n->keys[i].integer);
+  }
+  for (int i = n->n; i < BPTREE_KEYS; i++)
+    ASSERT_EQ(n->keys[i].integer, INT64_MAX);
+  if (n->leaf)
+    return 1;
+  int depth = 0;
+  for (int i = 0; i <= n->n; i++) {
+    int d = bp_check(n->u.children[i], i ? n->keys[i - 1].integer : lo, i < n->n ? n->keys[i].integer : hi);
+    if (i)
+      ASSERT_EQ(d, depth);
+    depth = d;
+  }
+  return depth + 1;
+}
+
+// Random inserts and deletes of integer keys, checked against a presence array
+void test_bptree_integer(void) {
+  int range = 20000;
+  bool *present = calloc(range, sizeof(bool));
+  size_t count = 0;
+  bptree t;
+  mk_bptree(&t, NULL);
+  srand(2);
+  for (int step = 0; step < 200000; step++) {
+    int k = rand() % range;
+    bptree_key key = { .integer = k * 2 };
+    if (rand() % 3) {
+      ASSERT_EQ(bptree_insert(&t, key, (void*)(intptr_t)k), !present[k]);
+      count += !present[k];
+      present[k] = true;
+    } else {
+      void *removed = NULL;
+      ASSERT_EQ(bptree_delete(&t, key, &removed), present[k]);
+      if (present[k])
+        ASSERT_EQ((intptr_t)removed, k);
+      count -= present[k];
+      present[k] = false;
+    }
+    ASSERT_EQ(t.count, count);
+  }
+  bp_check(t.root, INT64_MIN, INT64_MAX);
+
+  for (int k = 0; k < range; k++) {
+    void *value;
+    ASSERT_EQ(bptree_find(&t, (bptree_key) { .integer = k * 2 }, &value), present[k]);
+    if (present[k])
+      ASSERT_EQ((intptr_t)value, k);
+    ASSERT(!bptree_find(&t, (bptree_key) { .integer = k * 2 + 1 }, NULL));
+  }
+
+  // range scan from the lower bound of an odd number that is not in the tree
+  for (int k = 0; k < range; k += 97) {
+    bptree_cursor c = bptree_lower_bound(&t, (bptree_key) { .integer = k * 2 - 1 });
+    int expected = k;
+    for (int i = 0; i < 200; i++) {
+      while (expected < range && !present[expected])
+        expected++;
+      if (expected == range) {
+        ASSERT(!bptree_cursor_valid(&c));
+        break;
+      }
+      ASSERT(bptree_cursor_valid(&c));
+      ASSERT_EQ(bptree_cursor_key(&c).integer, expected * 2);
+      bptree_cursor_next(&c);
+      expected++;
+    }
+  }
+
+  size_t seen = 0;
+  int64_t last = INT64_MIN;
+  for (bptree_cursor c = bptree_first(&t); bptree_cursor_valid(&c); bptree_cursor_next(&c), seen++) {
+    ASSERT(bptree_cursor_key(&c).integer > last);
+    last = bptree_cursor_key(&c).integer;
+  }
+  ASSERT_EQ(seen, count);
+
+  // the extremes of the key space are valid keys
+  ASSERT(bptree_insert(&t, (bptree_key) { .integer = INT64_MAX }, NULL));
+  ASSERT(bptree_insert(&t, (bptree_key) { .integer = INT64_MIN }, NULL));
+  ASSERT(bptree_find(&t, (bptree_key) { .integer = INT64_MAX }, NULL));
+  ASSERT(bptree_find(&t, (bptree_key) { .integer = INT64_MIN }, NULL));
+  ASSERT_EQ(bptree_first(&t).leaf->keys[0].integer, INT64_MIN);
+  destroy_bptree(&t);
+  free(present);
+}
+
+// Sorted pointer keys ordered by a compare_func_t
+void test_bptree_generic(void) {
+  int n = 1 << 16;
+  int *keys = malloc(n * sizeof(int));
+  bptree t;
+  mk_bptree(&t, compare_int);
+  for (int i = 0; i < n; i++) {
+    keys[i] = n - i;
+    ASSERT(bptree_insert(&t, (bptree_key) { .pointer = &keys[i] }, &keys[i]));
+  }
+  ASSERT(!bptree_insert(&t, (bptree_key) { .pointer = &keys[0] }, NULL));
+  ASSERT_EQ(t.count, (size_t)n);
+
+  int i = 1;
+  for (bptree_cursor c = bptree_first(&t); bptree_cursor_valid(&c); bptree_cursor_next(&c), i++) {
+    ASSERT_EQ(*(const int*)bptree_cursor_key(&c).pointer, i);
+    ASSERT_EQ(*(const int*)bptree_cursor_value(&c), i);
+  }
+  ASSERT_EQ(i, n + 1);
+
+  for (i = 0; i < n; i += 2)
+    ASSERT(bptree_delete(&t, (bptree_key) { .pointer = &keys[i] }, NULL));
+  ASSERT_EQ(t.count, (size_t)n / 2);
+  int probe = n - 2;
+  bptree_cursor c = bptree_lower_bound(&t, (bptree_key) { .pointer = &probe });
+  ASSERT_EQ(*(const int*)bptree_cursor_key(&c).pointer, n - 1);
+  bptree_cursor_next(&c);
+  ASSERT(!bptree_cursor_valid(&c));
+  destroy_bptree(&t);
+  free(keys);
+}
+
+// Every lower bound of both static layouts agrees with a binary search over the sorted keys
+void test_eytzinger(void) {
+  for (size_t n = 0; n < 600; n += 1 + n / 8) {
+    int64_t *sorted = malloc((n + 1) * sizeof(int64_t));
+    for (size_t i = 0; i < n; i++)
+      sorted[i] = (int64_t)i * 3 - 100;
+    eytzinger_t e;
+    eytzinger_kary_t k;
+    mk_eytzinger(&e, sorted, n);
+    mk_eytzinger_kary(&k, sorted, n);
+    for (int64_t key = -103; key < (int64_t)n * 3 - 97; key++) {
+      size_t expected = 0;
+      while (expected < n && sorted[expected] < key)
+        expected++;
+      size_t i = eytzinger_lower_bound(&e, key), j = eytzinger_kary_lower_bound(&k, key);
+      if (expected == n) {
+        ASSERT_EQ(i, (size_t)0);
+        ASSERT_EQ(j, k.blocks * EYTZINGER_KARY_B);
+      } else {
+        ASSERT_EQ(e.keys[i], sorted[expected]);
+        ASSERT_EQ(k.keys[j], sorted[expected]);
+      }
+      ASSERT_EQ(eytzinger_find(&e, key), expected < n && sorted[expected] == key);
+      ASSERT_EQ(eytzinger_kary_find(&k, key), expected < n && sorted[expected] == key);
+    }
+    destroy_eytzinger(&e);
+    destroy_eytzinger_kary(&k);
+    free(sorted);
+  }
+
+  // built from a B+tree, including the extremes of the key space
+  bptree t;
+  eytzinger_t e;
+  eytzinger_kary_t k;
+  mk_bptree(&t, NULL);
+  for (int i = 0; i < 10000; i++)
+    bptree_insert(&t, (bptree_key) { .integer = (int64_t)(i * 7919 % 10000) * 2 }, NULL);
+  bptree_insert(&t, (bptree_key) { .integer = INT64_MAX }, NULL);
+  bptree_insert(&t, (bptree_key) { .integer = INT64_MIN }, NULL);
+  mk_eytzinger_bptree(&e, &t);
+  mk_eytzinger_kary_bptree(&k, &t);
+  for (int64_t key = -10; key < 20010; key++) {
+    ASSERT_EQ(eytzinger_find(&e, key), key >= 0 && key < 20000 && key % 2 == 0);
+    ASSERT_EQ(eytzinger_kary_find(&k, key), key >= 0 && key < 20000 && key % 2 == 0);
+  }
+  ASSERT(eytzinger_find(&e, INT64_MAX) && eytzinger_find(&e, INT64_MIN));
+  ASSERT(eytzinger_kary_find(&k, INT64_MAX) && eytzinger_kary_find(&k, INT64_MIN));
+  ASSERT_EQ(k.keys[eytzinger_kary_lower_bound(&k, 20000)], INT64_MAX);
+  destroy_eytzinger(&e);
+  destroy_eytzinger_kary(&k);
+  destroy_bptree(&t);
+}
+
+typedef struct {
+  unsigned char key[40];
+  size_t len;
+} art_test_key;
+
+int compare_bytes(const void *left, const void *right) {
+  const art_test_key *l = left, *r = right;
+  int c = memcmp(l->key, r->key, l->len < r->len ? l->len : r->len);
+  return c ? c : (l->len > r->len) - (l->len < r->len);
+}
+
+typedef struct {
+  const art_test_key *expected;
+  size_t seen, stop;
+} art_test_walk;
+
+int check_next_key(void *data, const unsigned char *key, size_t len, void *value) {
+  art_test_walk *w = data;
+  const art_test_key *k = &w->expected[w->seen++];
+  ASSERT_EQ(len, k->len);
+  ASSERT(memcmp(key, k->key, len) == 0);
+  ASSERT_EQ((size_t)(uintptr_t)value, k->len);
+  return w->seen == w->stop;
+}
+
+// Random keys over a small alphabet, so that many keys are prefixes of each other, and keys
+// sharing compressed paths longer than the bytes stored in a node
+void test_art(void) {
+  size_t n = 20000, unique = 0;
+  art_test_key *keys = malloc(n * sizeof(art_test_key));
+  art_tree t;
+  ASSERT(mk_art(&t));
+  srand(4);
+  for (size_t i = 0; i < n; i++) {
+    art_test_key *k = &keys[unique];
+    k->len = rand() % 12;
+    if (i % 4 == 0) {
+      memcpy(k->key, "a shared compressed path", 24);
+      for (size_t j = 0; j < k->len; j++)
+        k->key[24 + j] = "xyz"[rand() % 3];
+      k->len += 24;
+    } else {
+      // a few leading bytes from a small alphabet, then random bytes for wide nodes
+      for (size_t j = 0; j < k->len; j++)
+        k->key[j] = j < 2 || i % 4 == 1 ? "abc\xff"[rand() % 4] : rand() % 256;
+    }
+    bool found = art_find(&t, k->key, k->len, NULL);
+    ASSERT_EQ(art_insert(&t, k->key, k->len, (void*)(uintptr_t)k->len), !found);
+    ASSERT(art_find(&t, k->key, k->len, NULL));
+    unique += !found;
+  }
+  ASSERT_EQ(t.count, unique);
+  qsort(keys, unique, sizeof(art_test_key), compare_bytes);
+
+  for (size_t i = 0; i < unique; i++) {
+    void *value;
+    ASSERT(art_find(&t, keys[i].key, keys[i].len, &value));
+    ASSERT_EQ((size_t)(uintptr_t)value, keys[i].len);
+    // one byte longer, and one byte shorter if that is not a key itself
+    art_test_key probe = keys[i];
+    probe.key[probe.len++] = 'q';
+    ASSERT_EQ(art_find(&t, probe.key, probe.len, NULL), bsearch(&probe, keys, unique, sizeof(art_test_key), compare_bytes) != NULL);
+    if (keys[i].len) {
+      probe.len -= 2;
+      ASSERT_EQ(art_find(&t, probe.key, probe.len, NULL), bsearch(&probe, keys, unique, sizeof(art_test_key), compare_bytes) != NULL);
+    }
+  }
+
+  art_test_walk w = { .expected = keys };
+  ASSERT_EQ(art_iterate(&t, check_next_key, &w), 0);
+  ASSERT_EQ(w.seen, unique);
+  w = (art_test_walk) { .expected = keys, .stop = 10 };
+  ASSERT_EQ(art_iterate(&t, check_next_key, &w), 1);
+
+  // every prefix of some keys, checked against a scan of the sorted keys
+  for (size_t i = 0; i < unique; i += 37) {
+    for (size_t len = 0; len <= keys[i].len; len += 3) {
+      size_t first = 0;
+      art_test_key prefix = keys[i];
+      prefix.len = len;
+      while (compare_bytes(&keys[first], &prefix) < 0)
+        first++;
+      size_t last = first;
+      while (last < unique && keys[last].len >= len && memcmp(keys[last].key, prefix.key, len) == 0)
+        last++;
+      w = (art_test_walk) { .expected = keys + first };
+      ASSERT_EQ(art_iterate_prefix(&t, prefix.key, len, check_next_key, &w), 0);
+      ASSERT_EQ(w.seen, last - first);
+    }
+  }
+  w = (art_test_walk) { .expected = keys };
+  ASSERT_EQ(art_iterate_prefix(&t, "a shared compressed paq", 23, check_next_key, &w), 0);
+  ASSERT_EQ(w.seen, (size_t)0);
+
+  destroy_art(&t);
+  free(keys);
+}
+
+typedef struct {
+  int last;
+  size_t count;
+} skiplist_test_scan;
+
+int check_ascending(void *data, const void *key, void *value) {
+  skiplist_test_scan *scan = data;
+  ASSERT(*(const int*)key > scan->last);
+  ASSERT(key == value);
+  scan->last = *(const int*)key;
+  scan->count++;
+  return 0;
+}
+
+// Random inserts and deletes from one thread, checked against a presence array
+void test_skiplist_single(void) {
+  int range = 5000;
+  int *keys = malloc(range * sizeof(int));
+  bool *present = calloc(range, sizeof(bool));
+  size_t count = 0;
+  skiplist s;
+  mk_skiplist(&s, compare_int);
+  skiplist_handle *h = skiplist_join(&s);
+  srand(5);
+  for (int i = 0; i < range; i++)
+    keys[i] = i * 2;
+  for (int step = 0; step < 100000; step++) {
+    int k = rand() % range;
+    if (rand() % 2) {
+      ASSERT_EQ(skiplist_insert(h, &keys[k], &keys[k]), !present[k]);
+      count += !present[k];
+      present[k] = true;
+    } else {
+      void *removed = NULL;
+      ASSERT_EQ(skiplist_delete(h, &keys[k], &removed), present[k]);
+      if (present[k])
+        ASSERT(removed == &keys[k]);
+      count -= present[k];
+      present[k] = false;
+    }
+  }
+  for (int k = 0; k < range; k++) {
+    void *value = NULL;
+    ASSERT_EQ(skiplist_find(h, &keys[k], &value), present[k]);
+    if (present[k])
+      ASSERT(value == &keys[k]);
+  }
+  skiplist_test_scan scan = { .last = -1 };
+  ASSERT_EQ(skiplist_range(h, NULL, NULL, check_ascending, &scan), 0);
+  ASSERT_EQ(scan.count, count);
+
+  // [keys[100], keys[200]) from the lower bound of an odd number
+  int lo = keys[100] - 1;
+  size_t expected = 0;
+  for (int k = 100; k < 200; k++)
+    expected += present[k];
+  scan = (skiplist_test_scan) { .last = -1 };
+  skiplist_range(h, &lo, &keys[200], check_ascending, &scan);
+  ASSERT_EQ(scan.count, expected);
+
+  skiplist_leave(h);
+  destroy_skiplist(&s);
+  free(keys);
+  free(present);
+}
+
+typedef struct {
+  skiplist *list;
+  int *keys;
+  int range;
+  unsigned seed;
+  size_t inserted, deleted;
+} skiplist_test_thread;
+
+void *skiplist_worker(void *arg) {
+  skiplist_test_thread *t = arg;
+  skiplist_handle *h = skiplist_join(t->list);
+  for (int step = 0; step < 100000; step++) {
+    int k = rand_r(&t->seed) % t->range;
+    int op = rand_r(&t->seed) % 4;
+    if (op == 0)
+      t->inserted += skiplist_insert(h, &t->keys[k], &t->keys[k]);
+    else if (op == 1)
+      t->deleted += skiplist_delete(h, &t->keys[k], NULL);
+    else
+      skiplist_find(h, &t->keys[k], NULL);
+  }
+  skiplist_leave(h);
+  return NULL;
+}
+
+// Threads inserting and deleting the same keys. Each successful insert adds a key and each
+// successful delete removes one, so together they must account for what is left in the list.
+void test_skiplist_threads(void) {
+  enum { THREADS = 4 };
+  int range = 512;
+  int *keys = malloc(range * sizeof(int));
+  skiplist s;
+  skiplist_test_thread threads[THREADS];
+  pthread_t ids[THREADS];
+  size_t count = 0;
+  for (int i = 0; i < range; i++)
+    keys[i] = i;
+  mk_skiplist(&s, compare_int);
+  for (int i = 0; i < THREADS; i++) {
+    threads[i] = (skiplist_test_thread) { .list = &s, .keys = keys, .range = range, .seed = i + 1 };
+    pthread_create(&ids[i], NULL, skiplist_worker, &threads[i]);
+  }
+  for (int i = 0; i < THREADS; i++) {
+    pthread_join(ids[i], NULL);
+    count += threads[i].inserted - threads[i].deleted;
+  }
+
+  skiplist_handle *h = skiplist_join(&s);
+  skiplist_test_scan scan = { .last = -1 };
+  skiplist_range(h, NULL, NULL, check_ascending, &scan);
+  ASSERT_EQ(scan.count, count);
+  size_t found = 0;
+  for (int k = 0; k < range; k++)
+    found += skiplist_find(h, &keys[k], NULL);
+  ASSERT_EQ(found, count);
+  skiplist_leave(h);
+  destroy_skiplist(&s);
+  free(keys);
+}
+
+// The handle to stall, and how far the epoch moved while it was stalled
+static skiplist_handle *stalled;
+static int stalling, stall_done;
+
+void skiplist_stall(skiplist_handle *h) {
+  if (__atomic_load_n(&stalled, __ATOMIC_ACQUIRE) != h || !__atomic_exchange_n(&stalled, NULL, __ATOMIC_ACQ_REL))
+    return;
+  __atomic_store_n(&stalling, 1, __ATOMIC_RELEASE);
+  while (!__atomic_load_n(&stall_done, __ATOMIC_ACQUIRE))
+    sched_yield();
+}
+
+// While the other thread is stalled it is not announced, so nothing holds the epoch back
+void *skiplist_advancer(void *arg) {
+  skiplist *s = arg;
+  while (!__atomic_load_n(&stalling, __ATOMIC_ACQUIRE))
+    sched_yield();
+  uint64_t start = __atomic_load_n(&s->epoch, __ATOMIC_ACQUIRE);
+  while (__atomic_load_n(&s->epoch, __ATOMIC_ACQUIRE) < start + 3)
+    try_advance(s);
+  __atomic_store_n(&stall_done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+// A thread descheduled between reading the epoch and announcing it must not announce an epoch the
+// list has left, or it files the nodes it retires under a limbo list which is freed too early
+void test_skiplist_stalled_enter(void) {
+  skiplist s;
+  pthread_t advancer;
+  int keys[] = { 1, 2, 3 };
+  mk_skiplist(&s, compare_int);
+  skiplist_handle *h = skiplist_join(&s);
+  for (size_t i = 0; i < LENGTH(keys); i++)
+    ASSERT(skiplist_insert(h, &keys[i], NULL));
+  uint64_t before = __atomic_load_n(&s.epoch, __ATOMIC_ACQUIRE);
+  stalling = stall_done = 0;
+  __atomic_store_n(&stalled, h, __ATOMIC_RELEASE);
+  pthread_create(&advancer, NULL, skiplist_advancer, &s);
+  enter(h);
+  ASSERT(__atomic_load_n(&s.epoch, __ATOMIC_ACQUIRE) >= before + 3);
+  ASSERT_EQ(h->announced >> 1, __atomic_load_n(&s.epoch, __ATOMIC_ACQUIRE));
+  leave(h);
+  pthread_join(advancer, NULL);
+  // the list still works after the stall
+  ASSERT(skiplist_delete(h, &keys[1], NULL));
+  ASSERT(!skiplist_find(h, &keys[1], NULL));
+  ASSERT(skiplist_find(h, &keys[2], NULL));
+  skiplist_leave(h);
+  destroy_skiplist(&s);
+}
+
+// Walk a tree, or a subtree of it, and compare the values in the order of the walk
+void assert_walk(tree_t *root, order_t order, const int *expected, int n) {
+  int i = 0;
+  for (treewalk_t w = mk_treewalk(root, order); treewalk_next(&w); i++) {
+    ASSERT(i < n);
+    ASSERT_EQ(w.node->value, expected[i]);
+  }
+  ASSERT_EQ(i, n);
+}
+
+void test_treewalk(void) {
+  int values[] = { 8, 4, 12, 2, 6, 10, 14, 1, 3 };
+  int pre[] = { 8, 4, 2, 1, 3, 6, 12, 10, 14 };
+  int in[] = { 1, 2, 3, 4, 6, 8, 10, 12, 14 };
+  int post[] = { 1, 3, 2, 6, 4, 10, 14, 12, 8 };
+  int left_pre[] = { 4, 2, 1, 3, 6 };
+  int left_post[] = { 1, 3, 2, 6, 4 };
+  tree_t *root = mk_tree(values[0]);
+  for (size_t i = 1; i < LENGTH(values); i++)
+    ASSERT_EQ(insert(root, values[i])->value, values[i]);
+
+  assert_walk(root, PREORDER, pre, LENGTH(pre));
+  assert_walk(root, INORDER, in, LENGTH(in));
+  assert_walk(root, POSTORDER, post, LENGTH(post));
+  // a walk over a subtree stops at its root
+  assert_walk(root->l, PREORDER, left_pre, LENGTH(left_pre));
+  assert_walk(root->l, INORDER, in, LENGTH(left_pre));
+  assert_walk(root->l, POSTORDER, left_post, LENGTH(left_post));
+  assert_walk(root->r->r, INORDER, &in[8], 1);
+  assert_walk(NULL, INORDER, NULL, 0);
+  ASSERT_EQ(tree_depth(root), 3);
+  ASSERT_EQ(tree_depth(root->r), 1);
+
+  // every node is visited three times, and the level of each visit is the depth of the node
+  int visits = 0;
+  for (treewalk_t w = mk_treewalk(root, PREORDER); w.node; treewalk_step(&w), visits++) {
+    int level = 0;
+    for (tree_t *n = w.node; n != root; n = n->p)
+      level++;
+    ASSERT_EQ(w.level, level);
+  }
+  ASSERT_EQ(visits, 3 * (int)LENGTH(values));
+  destroy_tree(root);
+}
+
+// A tree from mk_tree_sorted is complete: every level but the last is full, and the last is filled from the left
+void test_tree_sorted(void) {
+  int sizes[] = { 0, 1, 2, 3, 5, 7, 8, 9, 15, 16, 17, 31, 33, 1023, 1025 };
+  for (size_t s = 0; s < LENGTH(sizes); s++) {
+    int n = sizes[s];
+    int *values = malloc((n ? n : 1) * sizeof(int));
+    for (int sorted = 0; sorted < 2; sorted++) {
+      // unsorted input is a permutation with every other value negated
+      for (int i = 0; i < n; i++)
+        values[i] = sorted ? i - n / 2 : (i * 7919) % n * (i % 2 ? -1 : 1);
+      tree_t *root = mk_tree_sorted(values, n, sorted);
+      if (!n) {
+        ASSERT(root == NULL);
+        continue;
+      }
+      int depth = 0;
+      while ((2 << depth) - 1 < n)
+        depth++;
+      ASSERT(root->p == NULL);
+      ASSERT_EQ(tree_depth(root), depth);
+
+      // in order, and breadth first the nodes take the n first positions of a perfect tree
+      int count = 0, last = 0;
+      for (treewalk_t w = mk_treewalk(root, INORDER); treewalk_next(&w); count++) {
+        tree_t *node = w.node;
+        if (count)
+          ASSERT(node->value > last);
+        last = node->value;
+        if (node->l)
+          ASSERT(node->l->p == node);
+        if (node->r)
+          ASSERT(node->r->p == node && node->l);
+        // position of the node in breadth first order, from its path to the root
+        long position = 0, bit = 1;
+        for (tree_t *c = node; c->p; c = c->p, bit <<= 1)
+          position += c == c->p->r ? bit : 0;
+        ASSERT(bit - 1 + position < n);
+        ASSERT_EQ(node->value, values[count]);
+      }
+      ASSERT_EQ(count, n);
+
+      // nodes inserted later are freed separately from the block
+      insert(root, n);
+      insert(root, -n - 1);
+      destroy_tree(root);
+    }
+    free(values);
+  }
+}
+
+int main(void) {
+  test_rbtree_sorted();
+  test_rbtree_random();
+  test_bptree_integer();
+  test_bptree_generic();
+  test_eytzinger();
+  test_art();
+  test_skiplist_single();
+  test_skiplist_threads();
+  test_skiplist_stalled_enter();
+  test_treewalk();
+  test_tree_sorted();
+  return 0;
+}